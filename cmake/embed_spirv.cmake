@@ -0,0 +1,40 @@
+# Writes SPIR-V binaries into a header as constexpr arrays, together with a table to find them by
+# the path the engine would load the shader source from. Run in script mode:
+#   cmake -DOUTPUT=<header> -DSPIRV_FILES=<a.spv,b.spv> -DSHADER_NAMES=<shaders/a.rgen,shaders/b.rmiss> -P embed_spirv.cmake
+# The lists are separated by commas, as semicolons would not survive the build tool's shell.
+
+string(REPLACE "," ";" SPIRV_FILES "${SPIRV_FILES}")
+string(REPLACE "," ";" SHADER_NAMES "${SHADER_NAMES}")
+
+# CMake's regular expressions have no {n} quantifier.
+string(REPEAT "0x........, " 8 LINE_PATTERN)
+
+set(ARRAYS "")
+set(TABLE "")
+foreach(SPIRV_FILE SHADER_NAME IN ZIP_LISTS SPIRV_FILES SHADER_NAMES)
+  file(READ "${SPIRV_FILE}" SPIRV_HEX HEX)
+  # SPIR-V is a stream of little endian 32-bit words, eight of which go on each line.
+  string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1, " SPIRV_WORDS "${SPIRV_HEX}")
+  string(REGEX REPLACE "(${LINE_PATTERN})" "\\1\n        " SPIRV_WORDS "${SPIRV_WORDS}")
+  string(MAKE_C_IDENTIFIER "${SHADER_NAME}" IDENTIFIER)
+  string(APPEND ARRAYS "    constexpr uint32_t ${IDENTIFIER}[] = {\n        ${SPIRV_WORDS}\n    };\n\n")
+  string(APPEND TABLE "        { \"${SHADER_NAME}\", ${IDENTIFIER} },\n")
+endforeach()
+
+file(WRITE "${OUTPUT}" "// Generated by cmake/embed_spirv.cmake from the shaders/ directory, do not edit.
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace dp::spirv {
+${ARRAYS}    struct EmbeddedShader {
+        std::string_view path;
+        std::span<const uint32_t> binary;
+    };
+
+    constexpr EmbeddedShader shaders[] = {
+${TABLE}    };
+}
+")
@@ -1,5 +1,10 @@
 #extension GL_ARB_gpu_shader_int64 : enable
 
+// The IDs of the specialization constants, which are set per pipeline variant.
+// They have to match dp::SpecializationId in src/vulkan/shaders/shader.hpp.
+const uint sample_count_constant_id = 0;
+const uint max_bounce_depth_constant_id = 1;
+
 struct HitPayload {
     vec3 hitValue;
     vec3 origin;
@@ -14,6 +19,16 @@ struct Vertex {
     float padding;
 };
 
+/** A compact vertex, with an octahedral encoded snorm16x2 normal and a half2 UV. */
+struct PackedVertex {
+    vec3 position;
+    uint normal;
+    uint uv;
+};
+
+const uint vertex_encoding_full = 0;
+const uint vertex_encoding_packed = 1;
+
 /** A single BLAS. */
 struct InstanceDescription {
     uint64_t vertexBufferAddress;
@@ -26,6 +41,10 @@ struct GeometryDescription {
     uint64_t vertexOffset;
     uint64_t indexOffset;
     uint materialIndex;
+    /** Size of a single index in bytes, either 2 or 4. */
+    uint indexSize;
+    uint vertexEncoding;
+    uint padding;
 };
 
 /** Represents a material with different base colours and
@@ -1,5 +1,36 @@
 /** We assume this file is included *after* the instance description and geometry description
  * buffers have been declared. */
+
+/** Reads a single index, which is either 16 or 32 bits wide. 16-bit indices are packed in pairs. */
+uint getIndex(in Indices indices, in uint indexSize, in uint i) {
+    if (indexSize == 2) {
+        return (indices.i[i >> 1] >> ((i & 1u) * 16u)) & 0xFFFFu;
+    }
+    return indices.i[i];
+}
+
+vec3 decodeOctahedralNormal(in vec2 encoded) {
+    vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float t = max(-normal.z, 0.0);
+    normal.x += normal.x >= 0.0 ? -t : t;
+    normal.y += normal.y >= 0.0 ? -t : t;
+    return normalize(normal);
+}
+
+/** Reads a single vertex, decoding it if it is a PackedVertex. */
+Vertex getVertex(in uint64_t address, in uint vertexEncoding, in uint i) {
+    if (vertexEncoding == vertex_encoding_packed) {
+        PackedVertex packed = PackedVertices(address).v[i];
+        Vertex vertex;
+        vertex.position = packed.position;
+        vertex.normal = decodeOctahedralNormal(unpackSnorm2x16(packed.normal));
+        vertex.uv = unpackHalf2x16(packed.uv);
+        vertex.padding = 1.0;
+        return vertex;
+    }
+    return Vertices(address).v[i];
+}
+
 Triangle getTriangle(in uint index, in uint geometryIndex, in uint primitive, in const vec3 barycentrics) {
     Triangle tri;
 
@@ -10,12 +41,13 @@ Triangle getTriangle(in uint index, in uint geometryIndex, in uint primitive, in
     tri.materialIndex = geometry.materialIndex;
 
     Indices indices = Indices(instance.indexBufferAddress + geometry.indexOffset);
-    Vertices vertices = Vertices(instance.vertexBufferAddress + geometry.vertexOffset);
+    uint64_t vertexAddress = instance.vertexBufferAddress + geometry.vertexOffset;
 
-    ivec3 primIndices = indices.i[primitive];
-    tri.vert[0] = vertices.v[primIndices.x];
-    tri.vert[1] = vertices.v[primIndices.y];
-    tri.vert[2] = vertices.v[primIndices.z];
+    uint firstIndex = primitive * 3;
+    for (uint i = 0; i < 3; ++i) {
+        uint vertexIndex = getIndex(indices, geometry.indexSize, firstIndex + i);
+        tri.vert[i] = getVertex(vertexAddress, geometry.vertexEncoding, vertexIndex);
+    }
 
     return tri;
 }
@@ -0,0 +1,127 @@
+// Compares the glTF vertex ingest paths of FileLoader::loadGlftMesh on synthetic attribute streams,
+// both tightly packed and interleaved into one strided buffer, as exported by most DCC tools.
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "../models/vertex_ingest.hpp"
+
+namespace {
+    // The original loader, which built each vertex from the attributes and pushed it back.
+    void ingestPushBack(dp::AttributeStream positions, dp::AttributeStream normals, dp::AttributeStream uvs,
+                        size_t count, std::vector<dp::Vertex>& vertices) {
+        vertices.clear();
+        for (size_t i = 0; i < count; ++i) {
+            dp::Vertex vertex = {};
+            memcpy(&vertex.pos, positions.data + i * positions.stride, sizeof(vertex.pos));
+            memcpy(&vertex.normals, normals.data + i * normals.stride, sizeof(vertex.normals));
+            memcpy(&vertex.uv, uvs.data + i * uvs.stride, sizeof(vertex.uv));
+            vertices.push_back(vertex);
+        }
+    }
+
+    // Copies each attribute in its own pass over the vertices.
+    void ingestPerAttribute(dp::AttributeStream positions, dp::AttributeStream normals, dp::AttributeStream uvs,
+                            size_t count, std::vector<dp::Vertex>& vertices) {
+        vertices.clear();
+        vertices.resize(count);
+        auto copyAttribute = [&](dp::AttributeStream stream, size_t size, size_t offset) {
+            auto* dst = reinterpret_cast<uint8_t*>(vertices.data()) + offset;
+            for (size_t i = 0; i < count; ++i)
+                memcpy(dst + i * sizeof(dp::Vertex), stream.data + i * stream.stride, size);
+        };
+        copyAttribute(positions, sizeof(glm::fvec3), offsetof(dp::Vertex, pos));
+        copyAttribute(normals, sizeof(glm::fvec3), offsetof(dp::Vertex, normals));
+        copyAttribute(uvs, sizeof(glm::fvec2), offsetof(dp::Vertex, uv));
+    }
+
+    // The current loader.
+    void ingestInterleaved(dp::AttributeStream positions, dp::AttributeStream normals, dp::AttributeStream uvs,
+                           size_t count, std::vector<dp::Vertex>& vertices) {
+        vertices.clear();
+        vertices.resize(count);
+        dp::interleaveVertices(positions, normals, uvs, count, vertices.data());
+    }
+
+    using IngestFunction = void (*)(dp::AttributeStream, dp::AttributeStream, dp::AttributeStream, size_t, std::vector<dp::Vertex>&);
+
+    struct Layout {
+        const char* name;
+        std::vector<uint8_t> buffer;
+        dp::AttributeStream positions = {};
+        dp::AttributeStream normals = {};
+        dp::AttributeStream uvs = {};
+    };
+
+    Layout makeLayout(const char* name, size_t count, bool interleaved) {
+        constexpr size_t vertexSize = 8 * sizeof(float);
+        Layout layout = { .name = name, .buffer = std::vector<uint8_t>(count * vertexSize) };
+        auto* floats = reinterpret_cast<float*>(layout.buffer.data());
+        for (size_t i = 0; i < count * 8; ++i)
+            floats[i] = static_cast<float>(i % 1024) * 0.25f;
+
+        const uint8_t* data = layout.buffer.data();
+        if (interleaved) {
+            layout.positions = { data, vertexSize };
+            layout.normals = { data + 12, vertexSize };
+            layout.uvs = { data + 24, vertexSize };
+        } else {
+            layout.positions = { data, 12 };
+            layout.normals = { data + count * 12, 12 };
+            layout.uvs = { data + count * 24, 8 };
+        }
+        return layout;
+    }
+
+    double measure(IngestFunction ingest, const Layout& layout, size_t count, size_t iterations, std::vector<dp::Vertex>& vertices) {
+        double best = 0.0;
+        for (size_t i = 0; i < iterations; ++i) {
+            // The original loader never reserved, so it is timed from an empty vector each time.
+            std::vector<dp::Vertex>().swap(vertices);
+            auto start = std::chrono::steady_clock::now();
+            ingest(layout.positions, layout.normals, layout.uvs, count, vertices);
+            std::chrono::duration<double, std::milli> time = std::chrono::steady_clock::now() - start;
+            if (i == 0 || time.count() < best)
+                best = time.count();
+        }
+        return best;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4'000'000;
+    const size_t iterations = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 10;
+
+    const struct {
+        const char* name;
+        IngestFunction function;
+    } paths[] = {
+        { "push_back", ingestPushBack },
+        { "per attribute", ingestPerAttribute },
+        { "interleaved", ingestInterleaved },
+    };
+
+    fmt::print("Ingesting {} vertices, best of {} runs\n", count, iterations);
+    for (bool interleaved : { false, true }) {
+        auto layout = makeLayout(interleaved ? "strided" : "packed", count, interleaved);
+
+        std::vector<dp::Vertex> reference;
+        ingestPushBack(layout.positions, layout.normals, layout.uvs, count, reference);
+
+        for (const auto& path : paths) {
+            std::vector<dp::Vertex> vertices;
+            double time = measure(path.function, layout, count, iterations, vertices);
+            if (vertices.size() != reference.size() || memcmp(vertices.data(), reference.data(), reference.size() * sizeof(dp::Vertex)) != 0) {
+                fmt::print(stderr, "{} produced different vertices for {} attributes!\n", path.name, layout.name);
+                return EXIT_FAILURE;
+            }
+            fmt::print("{:>8} {:>14}: {:8.2f}ms, {:6.2f} GB/s written\n", layout.name, path.name, time,
+                       static_cast<double>(count * sizeof(dp::Vertex)) / (time * 1e6));
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -1,12 +1,16 @@
 #include "engine.hpp"
 
+#include <algorithm>
+#include <cmath>
+
+#include <fmt/core.h>
+
 #include "sdl/window.hpp"
 #include "vulkan/utils.hpp"
 
 dp::Engine::Engine(dp::Context& context)
         : ctx(context), modelManager(ctx, *this), swapchain(ctx, ctx.surface),
           camera(ctx), ui(ctx, swapchain), storageImage(ctx),
-          shaderBindingTable(ctx, "shaderBindingTable"),
           rayGenShader(ctx, "raygen", dp::ShaderStage::RayGeneration),
           rayMissShader(ctx, "raymiss", dp::ShaderStage::RayMiss),
           closestHitShader(ctx, "closestHit", dp::ShaderStage::ClosestHit),
@@ -15,6 +19,16 @@ dp::Engine::Engine(dp::Context& context)
 
     this->getProperties();
 
+    // The shaders compile while the rest of the engine initializes, buildPipeline waits for them.
+    rayGenShader.createShaderAsync("shaders/raygen.rgen", shaderThreadPool);
+    rayMissShader.createShaderAsync("shaders/miss.rmiss", shaderThreadPool);
+    closestHitShader.createShaderAsync("shaders/closesthit.rchit", shaderThreadPool);
+    anyHitShader.createShaderAsync("shaders/anyhit.rahit", shaderThreadPool);
+#ifdef WITH_RUNTIME_SHADER_COMPILER
+    if (!shaderWatcher.watch("shaders"))
+        fmt::print(stderr, "Failed to watch the shader directory, shaders won't be reloaded.\n");
+#endif // #ifdef WITH_RUNTIME_SHADER_COMPILER
+
     camera.setPerspective(70.0f, 0.01f, 512.0f);
     camera.setRotation(glm::vec3(0.0f));
     camera.setPosition(glm::vec3(0.0f, 0.0f, -1.0f));
@@ -28,37 +42,64 @@ dp::Engine::Engine(dp::Context& context)
            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
     });
 
-    rayGenShader.createShader("shaders/raygen.rgen");
-    rayMissShader.createShader("shaders/miss.rmiss");
-    closestHitShader.createShader("shaders/closesthit.rchit");
-    anyHitShader.createShader("shaders/anyhit.rahit");
-
     modelManager.init();
     this->buildPipeline();
 
-    this->buildSBT();
+    this->createSbtRegions();
+    shaderBindingTables = this->buildSBT(pipeline);
 }
 
 void dp::Engine::getProperties() {
     VkPhysicalDeviceProperties2 deviceProperties = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, };
     deviceProperties.pNext = &this->rtProperties;
+    rtProperties.pNext = &this->descriptorIndexingProperties;
     vkGetPhysicalDeviceProperties2(ctx.physicalDevice, &deviceProperties);
+
+    maxTextureCount = std::min({
+        maxTextureCount,
+        descriptorIndexingProperties.maxDescriptorSetUpdateAfterBindSampledImages,
+        descriptorIndexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+    });
 }
 
-void dp::Engine::buildPipeline() {
-    if (pipeline.pipeline != nullptr) {
-        vkDestroyDescriptorSetLayout(ctx.device, pipeline.descriptorLayout, nullptr);
-        vkDestroyPipelineLayout(ctx.device, pipeline.pipelineLayout, nullptr);
-        vkDestroyPipeline(ctx.device, pipeline.pipeline, nullptr);
-    }
+auto dp::Engine::getShaders() -> std::array<dp::ShaderModule*, 4> {
+    return { &rayGenShader, &rayMissShader, &closestHitShader, &anyHitShader };
+}
 
+auto dp::Engine::getSpecializationConstants(const dp::RenderVariant& variant) -> dp::SpecializationConstants {
+    dp::SpecializationConstants constants;
+    constants.set(dp::SpecializationId::SampleCount, variant.sampleCount);
+    constants.set(dp::SpecializationId::MaxBounceDepth, variant.maxBounceDepth);
+    return constants;
+}
+
+auto dp::Engine::createPipelineBuilder() -> dp::RayTracingPipelineBuilder {
     // These need to be inputted in order.
     auto builder = dp::RayTracingPipelineBuilder::create(ctx, "rt_pipeline")
+        .setDescriptorSetCount(ctx.framesInFlight)
         .addShaderGroup(dp::RtShaderGroup::General, { rayGenShader })
         .addShaderGroup(dp::RtShaderGroup::General, { rayMissShader })
         .addShaderGroup(dp::RtShaderGroup::TriangleHit, { closestHitShader, anyHitShader });
 
     builder.addPushConstants(sizeof(PushConstants), dp::ShaderStage::ClosestHit | dp::ShaderStage::RayGeneration);
+    return builder;
+}
+
+void dp::Engine::buildPipeline() {
+    // Wait for the shaders before destroying anything, as a failed compile throws.
+    auto waitStart = std::chrono::steady_clock::now();
+    for (auto* shader : getShaders()) {
+        shader->wait();
+    }
+    std::chrono::duration<double, std::milli> waitTime = std::chrono::steady_clock::now() - waitStart;
+    if (waitTime.count() >= 1.0)
+        fmt::print("Waited {:.2f}ms for shaders to compile\n", waitTime.count());
+
+    if (pipeline.pipeline != nullptr) {
+        pipeline.destroy(ctx);
+    }
+
+    auto builder = createPipelineBuilder();
 
     auto descriptorAccelerationStructureInfo = modelManager.tlas.getDescriptorWrite();
     builder.addAccelerationStructureDescriptor(
@@ -72,7 +113,9 @@ void dp::Engine::buildPipeline() {
         VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, dp::ShaderStage::RayGeneration
     );
 
-    VkDescriptorBufferInfo cameraBufferInfo = camera.getDescriptorInfo();
+    // The builder writes the first frame's copy of the camera buffer into every set,
+    // the sets of the other frames are pointed to their own copy after the build.
+    VkDescriptorBufferInfo cameraBufferInfo = camera.getDescriptorInfo(0);
     builder.addBufferDescriptor(
         3, &cameraBufferInfo,
         VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, dp::ShaderStage::RayGeneration
@@ -91,69 +134,225 @@ void dp::Engine::buildPipeline() {
         VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, dp::ShaderStage::ClosestHit | dp::ShaderStage::AnyHit
     );
 
+    // The texture array is sized for the largest amount of textures we support, so that
+    // loading a scene only has to write the descriptors of its textures.
     std::vector<VkDescriptorImageInfo> textureInfos = modelManager.getTextureDescriptorInfos();
-    builder.addImageDescriptor(
-        6, textureInfos.data(),
-        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, dp::ShaderStage::ClosestHit| dp::ShaderStage::AnyHit,
-        textureInfos.size()
+    builder.addVariableImageDescriptor(
+        6, textureInfos.data(), static_cast<uint32_t>(textureInfos.size()),
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, dp::ShaderStage::ClosestHit | dp::ShaderStage::AnyHit,
+        maxTextureCount
     );
 
+    builder.setSpecializationConstants(getSpecializationConstants(options.renderVariants[options.renderVariantIndex]));
     pipeline = builder.build();
+    for (const auto& variant : options.renderVariants) {
+        builder.buildVariant(pipeline, getSpecializationConstants(variant), variant.name);
+    }
+    for (uint32_t i = 1; i < ctx.framesInFlight; ++i) {
+        cameraBufferInfo = camera.getDescriptorInfo(i);
+        VkWriteDescriptorSet cameraWrite = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = pipeline.descriptorSets[i],
+            .dstBinding = 3,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+            .pBufferInfo = &cameraBufferInfo,
+        };
+        vkUpdateDescriptorSets(ctx.device, 1, &cameraWrite, 0, nullptr);
+    }
+    // The builder has written the current scene into the sets of all frames.
+    staleSceneDescriptors.assign(ctx.framesInFlight, false);
 }
 
-void dp::Engine::buildSBT() {
-    uint32_t missCount = 1; // 1 miss groups
-    uint32_t chitCount = 1; // 1 hit group (with closest and any)
-    uint32_t callCount = 0;
-    auto handleCount = 1 + missCount + chitCount + callCount;
-    const uint32_t handleSize = rtProperties.shaderGroupHandleSize;
-    sbtStride = dp::Buffer::alignedSize(handleSize, rtProperties.shaderGroupHandleAlignment);
+void dp::Engine::createSbtRegions() {
+    sbtStride = dp::Buffer::alignedSize(rtProperties.shaderGroupHandleSize, rtProperties.shaderGroupHandleAlignment);
 
     raygenRegion.stride = dp::Buffer::alignedSize(sbtStride, rtProperties.shaderGroupBaseAlignment);
     raygenRegion.size = raygenRegion.stride; // RayGen size must be equal to the stride.
     missRegion.stride = sbtStride;
-    missRegion.size = dp::Buffer::alignedSize(missCount * sbtStride, rtProperties.shaderGroupBaseAlignment);
+    missRegion.size = dp::Buffer::alignedSize(sbtMissCount * sbtStride, rtProperties.shaderGroupBaseAlignment);
     chitRegion.stride = sbtStride;
-    chitRegion.size = dp::Buffer::alignedSize(chitCount * sbtStride, rtProperties.shaderGroupBaseAlignment);
+    chitRegion.size = dp::Buffer::alignedSize(sbtHitCount * sbtStride, rtProperties.shaderGroupBaseAlignment);
+}
+
+auto dp::Engine::buildSBT(const dp::RayTracingPipeline& rtPipeline) -> std::map<uint64_t, dp::Buffer> {
+    uint32_t callCount = 0;
+    auto handleCount = 1 + sbtMissCount + sbtHitCount + callCount;
+    const uint32_t handleSize = rtProperties.shaderGroupHandleSize;
 
     const uint32_t sbtSize = raygenRegion.size + missRegion.size + chitRegion.size + callableRegion.size;
     std::vector<uint8_t> handleStorage(sbtSize);
-    ctx.getRayTracingShaderGroupHandles(pipeline.pipeline, handleCount, sbtSize, handleStorage);
+    auto getHandleOffset = [&](uint32_t i) -> auto {
+        return handleStorage.data() + i * handleSize;
+    };
+
+    // Every pipeline variant has its own shader group handles, and therefore its own SBT.
+    std::map<uint64_t, dp::Buffer> tables;
+    for (const auto& [key, variant] : rtPipeline.variants) {
+        ctx.getRayTracingShaderGroupHandles(variant, handleCount, sbtSize, handleStorage);
+
+        auto& shaderBindingTable = tables.try_emplace(key, ctx, "shaderBindingTable").first->second;
+        shaderBindingTable.create(sbtSize,
+                                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR,
+                                  VMA_MEMORY_USAGE_CPU_TO_GPU);
+        shaderBindingTable.memoryCopy(handleStorage.data(), sbtSize);
+
+        uint32_t curHandleIndex = 0;
+
+        // Write raygen shader
+        shaderBindingTable.memoryCopy(getHandleOffset(curHandleIndex++), handleSize, 0);
+
+        // Write miss shaders
+        for (uint32_t i = 0; i < sbtMissCount; i++) {
+            shaderBindingTable.memoryCopy(
+                getHandleOffset(curHandleIndex++),
+                handleSize,
+                raygenRegion.size + missRegion.stride * i);
+        }
+
+        // Write chit shaders
+        for (uint32_t i = 0; i < sbtHitCount; i++) {
+            shaderBindingTable.memoryCopy(
+                getHandleOffset(curHandleIndex++),
+                handleSize,
+                raygenRegion.size + missRegion.size + chitRegion.stride * i);
+        }
+    }
+    return tables;
+}
+
+void dp::Engine::animateInstance() {
+    // A new scene comes with its own transforms, so the offset starts over once it has been loaded.
+    if (ui.reloadingScene) {
+        animationOffset = 0.0f;
+        return;
+    }
+    auto& instances = modelManager.meshInstances;
+    if ((!options.animateInstance && animationOffset == 0.0f) || instances.empty() || instances[0].meshIndex >= modelManager.blases.size())
+        return;
+
+    // The instance moves by the size of its mesh, so that the refits degrade the TLAS enough to
+    // also rebuild it. Only the change since the last frame is applied to its transform.
+    float offset = 0.0f;
+    if (options.animateInstance) {
+        const auto& blas = modelManager.blases[instances[0].meshIndex];
+        std::chrono::duration<float> time = std::chrono::steady_clock::now() - animationStart;
+        offset = glm::length(blas.maxBounds - blas.minBounds) * std::sin(time.count());
+    }
 
-    shaderBindingTable.create(sbtSize,
-                              VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR,
-                              VMA_MEMORY_USAGE_CPU_TO_GPU);
-    auto sbtAddress = shaderBindingTable.getDeviceAddress();
+    std::vector<VkTransformMatrixKHR> transforms(instances.size());
+    for (size_t i = 0; i < instances.size(); ++i) {
+        transforms[i] = instances[i].transform;
+    }
+    transforms[0].matrix[0][3] += offset - animationOffset;
+    animationOffset = offset;
+    modelManager.updateTlas(transforms);
+}
+
+auto dp::Engine::selectPipelineVariant() -> VkPipeline {
+    auto key = getSpecializationConstants(options.renderVariants[options.renderVariantIndex]).getKey();
+    auto sbtAddress = shaderBindingTables.at(key).getDeviceAddress();
     raygenRegion.deviceAddress = sbtAddress;
     missRegion.deviceAddress = sbtAddress + raygenRegion.size;
     chitRegion.deviceAddress = missRegion.deviceAddress + missRegion.size;
+    return pipeline.variants.at(key);
+}
 
-    shaderBindingTable.memoryCopy(handleStorage.data(), sbtSize);
+#ifdef WITH_RUNTIME_SHADER_COMPILER
+void dp::Engine::reloadShaders() {
+    destroyRetiredPipelines();
+
+    if (reloadedPipeline.valid()) {
+        if (reloadedPipeline.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return;
+
+        // The frames in flight might still use the previous pipeline and SBTs, which are retired
+        // instead of waiting for them. The descriptor sets are shared, so they stay as they are.
+        try {
+            auto reloaded = reloadedPipeline.get();
+            retiredPipelines.push_back({ ctx.framesInFlight, pipeline, std::move(shaderBindingTables) });
+            pipeline = reloaded.pipeline;
+            shaderBindingTables = std::move(reloaded.shaderBindingTables);
+            fmt::print("Reloaded {} shaders\n", reloaded.shaderCount);
+        } catch (const std::exception& exception) {
+            fmt::print(stderr, "Failed to rebuild the pipeline: {}\n", exception.what());
+        }
+        return;
+    }
 
-    auto getHandleOffset = [&](uint32_t i) -> auto {
-        return handleStorage.data() + i * handleSize;
-    };
-    uint32_t curHandleIndex = 0;
+    if (reloadingShaders.empty()) {
+        auto changedFiles = shaderWatcher.poll();
+        if (changedFiles.empty())
+            return;
+
+        // Only recompile the shaders that include any of the changed files.
+        for (auto* shader : getShaders()) {
+            bool affected = std::any_of(changedFiles.begin(), changedFiles.end(), [shader](const fs::path& file) {
+                return shader->dependsOn(file);
+            });
+            if (affected) {
+                shader->createShaderAsync(shader->getFilePath(), shaderThreadPool);
+                reloadingShaders.push_back(shader);
+            }
+        }
+        return;
+    }
 
-    // Write raygen shader
-    shaderBindingTable.memoryCopy(getHandleOffset(curHandleIndex++), handleSize, 0);
+    bool ready = std::all_of(reloadingShaders.begin(), reloadingShaders.end(), [](const dp::ShaderModule* shader) {
+        return shader->isReady();
+    });
+    if (!ready)
+        return;
+
+    // Every shader is checked, not only the reloaded ones, so that the pipeline is only built
+    // from shaders that all compiled.
+    auto shaderCount = reloadingShaders.size();
+    reloadingShaders.clear();
+    bool failed = false;
+    for (auto* shader : getShaders()) {
+        try {
+            shader->wait();
+        } catch (const std::exception& exception) {
+            fmt::print(stderr, "Failed to reload shaders: {}\n", exception.what());
+            failed = true;
+        }
+    }
+    if (failed) {
+        // Keep the previous pipeline. Saving the file again triggers another reload, which then
+        // also picks up the shaders of this batch that did compile.
+        return;
+    }
 
-    // Write miss shaders
-    for (uint32_t i = 0; i < missCount; i++) {
-        shaderBindingTable.memoryCopy(
-            getHandleOffset(curHandleIndex++),
-            handleSize,
-            raygenRegion.size + missRegion.stride * i);
+    // The shaders aren't recompiled while the pipeline is built, as no changes are polled until it
+    // has been swapped in.
+    auto variantIndex = options.renderVariantIndex;
+    reloadedPipeline = shaderThreadPool.submit([this, current = pipeline, variantIndex, shaderCount]() {
+        auto builder = createPipelineBuilder();
+        builder.setSpecializationConstants(getSpecializationConstants(options.renderVariants[variantIndex]));
+        ReloadedPipeline reloaded = { .pipeline = builder.rebuild(current), .shaderCount = shaderCount };
+        for (const auto& variant : options.renderVariants) {
+            builder.buildVariant(reloaded.pipeline, getSpecializationConstants(variant), variant.name);
+        }
+        reloaded.shaderBindingTables = buildSBT(reloaded.pipeline);
+        return reloaded;
+    });
+}
+
+void dp::Engine::destroyRetiredPipelines() {
+    for (auto& retired : retiredPipelines) {
+        --retired.remainingFrames;
     }
 
-    // Write chit shaders
-    for (uint32_t i = 0; i < chitCount; i++) {
-        shaderBindingTable.memoryCopy(
-            getHandleOffset(curHandleIndex++),
-            handleSize,
-            raygenRegion.size + missRegion.size + chitRegion.stride * i);
+    while (!retiredPipelines.empty() && retiredPipelines.front().remainingFrames == 0) {
+        auto& retired = retiredPipelines.front();
+        retired.pipeline.destroyVariants(ctx);
+        for (auto& [key, shaderBindingTable] : retired.shaderBindingTables) {
+            shaderBindingTable.destroy();
+        }
+        retiredPipelines.pop_front();
     }
 }
+#endif // #ifdef WITH_RUNTIME_SHADER_COMPILER
 
 void dp::Engine::renderLoop() {
     VkResult result;
@@ -174,20 +373,34 @@ void dp::Engine::renderLoop() {
         // Check model loading status
         modelManager.renderTick();
 
-        // Update the camera buffer.
-        camera.updateBuffer();
+#ifdef WITH_RUNTIME_SHADER_COMPILER
+        // Swap in the pipeline with reloaded shaders, if they're ready.
+        reloadShaders();
+#endif // #ifdef WITH_RUNTIME_SHADER_COMPILER
+
+        // Update this frame's copy of the camera buffer.
+        camera.updateBuffer(ctx.currentFrame);
+        animateInstance();
 
-        ctx.beginCommandBuffer(ctx.drawCommandBuffer, 0);
+        auto cmdBuffer = ctx.getCurrentFrame().commandBuffer;
+        ctx.beginCommandBuffer(cmdBuffer, 0);
         auto image = swapchain.images[ctx.currentImageIndex];
-        ctx.setCheckpoint(ctx.drawCommandBuffer, "Beginning.");
+        ctx.setCheckpoint(cmdBuffer, "Beginning.");
 
-        vkCmdBindPipeline(ctx.drawCommandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipeline.pipeline);
-        vkCmdBindDescriptorSets(ctx.drawCommandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipeline.pipelineLayout, 0, 1, &pipeline.descriptorSet, 0, nullptr);
+        // Refit the TLAS, if any instances have been moved.
+        modelManager.recordTlasUpdate(cmdBuffer);
+
+        // This frame's fence has been waited on, so its descriptor set is not in use anymore.
+        if (staleSceneDescriptors[ctx.currentFrame])
+            writeSceneDescriptors(ctx.currentFrame);
+
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, selectPipelineVariant());
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipeline.pipelineLayout, 0, 1, &pipeline.descriptorSets[ctx.currentFrame], 0, nullptr);
 
         auto now = std::chrono::system_clock::now();
         auto diff = now.time_since_epoch() - startTime.time_since_epoch();
         pushConstants.iTime = static_cast<float>(std::chrono::duration_cast<std::chrono::milliseconds>(diff).count()) / 1000; // Convert ms -> s.
-        vkCmdPushConstants(ctx.drawCommandBuffer, pipeline.pipelineLayout,
+        vkCmdPushConstants(cmdBuffer, pipeline.pipelineLayout,
                            static_cast<VkShaderStageFlags>(dp::ShaderStage::ClosestHit | dp::ShaderStage::RayGeneration),
                            0, sizeof(PushConstants), &pushConstants);
         if (pushConstants.iTime > 60.0f) {
@@ -196,9 +409,9 @@ void dp::Engine::renderLoop() {
             pushConstants.iTime = 0;
         }
 
-        ctx.setCheckpoint(ctx.drawCommandBuffer, "Tracing rays.");
+        ctx.setCheckpoint(cmdBuffer, "Tracing rays.");
         ctx.traceRays(
-            ctx.drawCommandBuffer,
+            cmdBuffer,
             &raygenRegion,
             &missRegion,
             &chitRegion,
@@ -206,37 +419,41 @@ void dp::Engine::renderLoop() {
             storageImage.getImageSize3d()
         );
 
-        ctx.setCheckpoint(ctx.drawCommandBuffer, "Changing image layout.");
+        ctx.setCheckpoint(cmdBuffer, "Changing image layout.");
         // Move storage image to swapchain image.
         storageImage.changeLayout(
-            ctx.drawCommandBuffer, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            cmdBuffer, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
             VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_TRANSFER_BIT);
 
-        dp::Image::changeLayout(image, ctx.drawCommandBuffer,
+        // The source stage matches the stage the frame waits on the acquired image at, so that the
+        // transition only happens once the presentation engine has released the image.
+        dp::Image::changeLayout(image, cmdBuffer,
                                 VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                                VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
                                 defaultSubresourceRange);
 
-        ctx.setCheckpoint(ctx.drawCommandBuffer, "Copying storage image.");
-        storageImage.copyImage(ctx.drawCommandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        ctx.setCheckpoint(cmdBuffer, "Copying storage image.");
+        storageImage.copyImage(cmdBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 
+        // The next frame might already trace rays into the storage image while this one is copied,
+        // so its ray tracing has to wait for the copy.
         storageImage.changeLayout(
-            ctx.drawCommandBuffer, VK_IMAGE_LAYOUT_GENERAL,
-            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
-        dp::Image::changeLayout(image, ctx.drawCommandBuffer,
+            cmdBuffer, VK_IMAGE_LAYOUT_GENERAL,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR);
+        dp::Image::changeLayout(image, cmdBuffer,
                                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
                                 // Fragment shader here, as the next stage will be imgui drawing.
                                 VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
                                 defaultSubresourceRange);
 
-        ctx.setCheckpoint(ctx.drawCommandBuffer, "Drawing UI.");
+        ctx.setCheckpoint(cmdBuffer, "Drawing UI.");
         // Draw the UI.
         ui.prepare();
-        ui.draw(*this, ctx.drawCommandBuffer);
+        ui.draw(*this, cmdBuffer);
 
         // End the command buffer and submit.
-        ctx.setCheckpoint(ctx.drawCommandBuffer, "Ending.");
-        vkEndCommandBuffer(ctx.drawCommandBuffer);
+        ctx.setCheckpoint(cmdBuffer, "Ending.");
+        vkEndCommandBuffer(cmdBuffer);
 
         auto guard = std::move(ctx.graphicsQueue.getLock());
         result = ctx.submitFrame(swapchain);
@@ -269,18 +486,20 @@ void dp::Engine::resize(const uint32_t width, const uint32_t height) {
             VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
     });
 
-    // Re-bind the storage image.
+    // Re-bind the storage image in the descriptor sets of all frames, as the device is idle.
     VkDescriptorImageInfo storageImageDescriptor = storageImage.getDescriptorImageInfo();
-    VkWriteDescriptorSet resultImageWrite = {
-        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-        .pNext = nullptr,
-        .dstSet = pipeline.descriptorSet,
-        .dstBinding = 1,
-        .descriptorCount = 1,
-        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-        .pImageInfo = &storageImageDescriptor,
-    };
-    vkUpdateDescriptorSets(ctx.device, 1, &resultImageWrite, 0, nullptr);
+    for (auto descriptorSet : pipeline.descriptorSets) {
+        VkWriteDescriptorSet resultImageWrite = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .pNext = nullptr,
+            .dstSet = descriptorSet,
+            .dstBinding = 1,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .pImageInfo = &storageImageDescriptor,
+        };
+        vkUpdateDescriptorSets(ctx.device, 1, &resultImageWrite, 0, nullptr);
+    }
 
     // Let the UI recreate.
     ui.recreate();
@@ -289,12 +508,61 @@ void dp::Engine::resize(const uint32_t width, const uint32_t height) {
 }
 
 void dp::Engine::updateTlas() {
-    // We'll have to rebuild the pipeline to account for new images and resized buffers.
-    // This also implicitly updates the TLAS.
-    buildPipeline();
+    // This is called before recording the frame's commands, whose descriptor set is rewritten
+    // right before it is bound. The previous buffers are kept alive by the model manager until
+    // the other frames have been rewritten as well.
+    modelManager.createDescriptionBuffers();
+    staleSceneDescriptors.assign(ctx.framesInFlight, true);
+}
 
-    // Descriptor set has been updated, recreate the UI's render passes too.
-    ui.recreate();
+void dp::Engine::writeSceneDescriptors(const uint32_t frameIndex) {
+    // The layout of the descriptor set never changes, so we only have to point the scene's
+    // descriptors to the new TLAS, buffers and textures.
+    auto descriptorAccelerationStructureInfo = modelManager.tlas.getDescriptorWrite();
+    VkDescriptorBufferInfo materialBufferInfo = modelManager.materialBuffer.getDescriptorInfo(VK_WHOLE_SIZE);
+    VkDescriptorBufferInfo descriptionsBufferInfo = modelManager.instanceDescriptionBuffer.getDescriptorInfo(VK_WHOLE_SIZE);
+    std::vector<VkDescriptorImageInfo> textureInfos = modelManager.getTextureDescriptorInfos();
+    if (textureInfos.size() > maxTextureCount) {
+        fmt::print(stderr, "The scene uses {} textures, but only {} are supported.\n", textureInfos.size(), maxTextureCount);
+        textureInfos.resize(maxTextureCount);
+    }
+
+    std::vector<VkWriteDescriptorSet> descriptorWrites = {
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .pNext = &descriptorAccelerationStructureInfo,
+            .dstSet = pipeline.descriptorSets[frameIndex],
+            .dstBinding = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = pipeline.descriptorSets[frameIndex],
+            .dstBinding = 4,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &materialBufferInfo,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = pipeline.descriptorSets[frameIndex],
+            .dstBinding = 5,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &descriptionsBufferInfo,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = pipeline.descriptorSets[frameIndex],
+            .dstBinding = 6,
+            .descriptorCount = static_cast<uint32_t>(textureInfos.size()),
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .pImageInfo = textureInfos.data(),
+        },
+    };
+    vkUpdateDescriptorSets(ctx.device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    staleSceneDescriptors[frameIndex] = false;
 }
 
 dp::Engine::PushConstants& dp::Engine::getConstants() {
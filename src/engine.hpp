@@ -1,6 +1,10 @@
 #pragma once
 
+#include <array>
 #include <chrono>
+#include <deque>
+#include <future>
+#include <map>
 
 #include "models/modelmanager.hpp"
 #include "render/camera.hpp"
@@ -9,6 +13,11 @@
 #include "vulkan/resource/storageimage.hpp"
 #include "vulkan/rt/rt_pipeline.hpp"
 #include "options.hpp"
+#include "utils/thread_pool.hpp"
+
+#ifdef WITH_RUNTIME_SHADER_COMPILER
+#include "utils/file_watcher.hpp"
+#endif // #ifdef WITH_RUNTIME_SHADER_COMPILER
 
 namespace dp {
     class Engine {
@@ -24,8 +33,35 @@ namespace dp {
         dp::ShaderModule rayMissShader;
         dp::ShaderModule closestHitShader;
         dp::ShaderModule anyHitShader;
+        /** Compiles the shaders in parallel. */
+        dp::ThreadPool shaderThreadPool;
+#ifdef WITH_RUNTIME_SHADER_COMPILER
+        /** A pipeline built from reloaded shaders, which shares the descriptor sets of the current pipeline. */
+        struct ReloadedPipeline {
+            dp::RayTracingPipeline pipeline;
+            std::map<uint64_t, dp::Buffer> shaderBindingTables;
+            size_t shaderCount = 0;
+        };
+        /** A replaced pipeline, which might still be used by the frames in flight. */
+        struct RetiredPipeline {
+            /** The amount of frames that still have to begin before it can be destroyed. */
+            uint32_t remainingFrames = 0;
+            dp::RayTracingPipeline pipeline;
+            std::map<uint64_t, dp::Buffer> shaderBindingTables;
+        };
 
-        dp::Buffer shaderBindingTable;
+        dp::FileWatcher shaderWatcher;
+        /** The shaders that are being recompiled, while the previous pipeline keeps rendering. */
+        std::vector<dp::ShaderModule*> reloadingShaders;
+        /** The pipeline being built on the shaderThreadPool once the reloaded shaders have compiled. */
+        std::future<ReloadedPipeline> reloadedPipeline;
+        std::deque<RetiredPipeline> retiredPipelines;
+#endif // #ifdef WITH_RUNTIME_SHADER_COMPILER
+
+        static constexpr uint32_t sbtMissCount = 1; // 1 miss groups
+        static constexpr uint32_t sbtHitCount = 1; // 1 hit group (with closest and any)
+        /** The SBT of each pipeline variant, with the same keys as RayTracingPipeline::variants. */
+        std::map<uint64_t, dp::Buffer> shaderBindingTables;
         VkStridedDeviceAddressRegionKHR raygenRegion = {};
         VkStridedDeviceAddressRegionKHR missRegion = {};
         VkStridedDeviceAddressRegionKHR chitRegion = {};
@@ -33,6 +69,9 @@ namespace dp {
         uint32_t sbtStride = 0;
 
         std::chrono::time_point<std::chrono::system_clock> startTime;
+        std::chrono::steady_clock::time_point animationStart = std::chrono::steady_clock::now();
+        /** How far the animated instance has been moved away from its own transform. */
+        float animationOffset = 0.0f;
 
         // Can't exceed 256 bytes, or 2 mat4s.
         struct PushConstants {
@@ -43,10 +82,44 @@ namespace dp {
         VkPhysicalDeviceRayTracingPipelinePropertiesKHR rtProperties = {
             .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR,
         };
+        VkPhysicalDeviceDescriptorIndexingProperties descriptorIndexingProperties = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES,
+        };
+
+        /** The size of the texture descriptor array, which is fixed when the pipeline is built. */
+        uint32_t maxTextureCount = 4096;
+        /** Whether the descriptor set of each frame in flight still points to a previous scene. */
+        std::vector<bool> staleSceneDescriptors;
 
         void getProperties();
+        [[nodiscard]] auto getShaders() -> std::array<dp::ShaderModule*, 4>;
+        [[nodiscard]] static auto getSpecializationConstants(const dp::RenderVariant& variant) -> dp::SpecializationConstants;
+        /** Creates a builder with the shader groups and push constants of our pipeline. */
+        [[nodiscard]] auto createPipelineBuilder() -> dp::RayTracingPipelineBuilder;
         void buildPipeline();
-        void buildSBT();
+        /** Sizes the SBT regions, which are the same for every pipeline. */
+        void createSbtRegions();
+        /** Creates an SBT for each variant of given pipeline. Only reads the SBT regions, so it can run on any thread. */
+        [[nodiscard]] auto buildSBT(const dp::RayTracingPipeline& rtPipeline) -> std::map<uint64_t, dp::Buffer>;
+        /** Points the descriptor set of given frame to the current TLAS, scene buffers and textures. */
+        void writeSceneDescriptors(uint32_t frameIndex);
+        /**
+         * Moves the first instance along the x axis while options.animateInstance is set, and moves it
+         * back once it is unset. Has to be called before the frame's commands are recorded.
+         */
+        void animateInstance();
+        /** Gets the pipeline variant chosen in the options, and points the SBT regions to its SBT. */
+        [[nodiscard]] auto selectPipelineVariant() -> VkPipeline;
+#ifdef WITH_RUNTIME_SHADER_COMPILER
+        /**
+         * Recompiles the shaders affected by changed files in the background, and then builds a new
+         * pipeline and SBTs from them on the shaderThreadPool. Once these are done, swaps them in and
+         * retires the previous ones. Has to be called once per frame, after the frame's fence has been waited on.
+         */
+        void reloadShaders();
+        /** Destroys the retired pipelines the frames in flight can't use anymore. */
+        void destroyRetiredPipelines();
+#endif // #ifdef WITH_RUNTIME_SHADER_COMPILER
 
     public:
         dp::Camera camera;
@@ -60,6 +133,11 @@ namespace dp {
 
         void renderLoop();
         void resize(uint32_t width, uint32_t height);
+        /**
+         * Rewrites the descriptors of the TLAS, the scene buffers and the textures after the scene has changed.
+         * The descriptor set of each frame is only rewritten once that frame is recorded next, as the others
+         * might still be in use by the frames in flight.
+         */
         void updateTlas();
         PushConstants& getConstants();
     };
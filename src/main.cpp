@@ -6,5 +6,6 @@ auto main(int argc, char* argv[]) -> int {
     
     dp::Engine engine(ctx);
     engine.renderLoop();
+    ctx.pipelineCache.save();
     return 0;
 }
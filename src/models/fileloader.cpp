@@ -5,11 +5,55 @@
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 
+#include <algorithm>
+#include <chrono>
+
 #include <dds.hpp> // DirectDraw Surface
 #include <fmt/core.h>
+#include <glm/gtc/matrix_transform.hpp> // glm::translate, glm::scale
+#include <glm/gtc/quaternion.hpp> // glm::mat4_cast
 #include <glm/gtc/type_ptr.hpp> // glm::make_vec3
 #include <tiny_gltf.h> // Already includes stb_image.h
 
+#include "meshoptimizer.hpp"
+#include "scenecache.hpp"
+#include "vertex_ingest.hpp"
+#include "../utils/binary_file.hpp"
+#include "../utils/hash.hpp"
+
+/** Widens indices of any unsigned type to dp::Index, 8 or 16 at a time when SSE2 is available. */
+template <typename T>
+void widenIndices(const T* src, size_t count, dp::Index* dst) {
+    static_assert(sizeof(T) <= sizeof(dp::Index));
+    if constexpr (sizeof(T) == sizeof(dp::Index)) {
+        memcpy(dst, src, count * sizeof(T));
+    } else {
+        size_t i = 0;
+#ifdef DP_USE_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        if constexpr (sizeof(T) == 1) {
+            for (; i + 16 <= count; i += 16) {
+                __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                __m128i low = _mm_unpacklo_epi8(bytes, zero);
+                __m128i high = _mm_unpackhi_epi8(bytes, zero);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi16(low, zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), _mm_unpackhi_epi16(low, zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_unpacklo_epi16(high, zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 12), _mm_unpackhi_epi16(high, zero));
+            }
+        } else {
+            for (; i + 8 <= count; i += 8) {
+                __m128i shorts = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi16(shorts, zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), _mm_unpackhi_epi16(shorts, zero));
+            }
+        }
+#endif
+        for (; i < count; ++i)
+            dst[i] = static_cast<dp::Index>(src[i]);
+    }
+}
+
 void getMatColor3(aiMaterial* material, const char* key, unsigned int type, unsigned int idx, glm::vec3* vec) {
     aiColor4D vec4;
     aiGetMaterialColor(material, key, type, idx, &vec4);
@@ -18,56 +62,69 @@ void getMatColor3(aiMaterial* material, const char* key, unsigned int type, unsi
     vec->g = vec4.g;
 }
 
-void dp::FileLoader::loadAssimpMesh(const aiMesh* mesh, aiMatrix4x4 transform, const aiScene* scene) {
-    if (!mesh->HasFaces()) return;
-
-    auto meshVertices = mesh->mVertices;
-    auto meshFaces = mesh->mFaces;
-
-    dp::Mesh newMesh = {};
+void dp::FileLoader::loadAssimpMesh(const aiMesh* mesh, dp::Mesh& newMesh) {
     newMesh.name = mesh->mName.data;
-    newMesh.transform = {
-        transform.a1, transform.a2, transform.a3, transform.a4,
-        transform.b1, transform.b2, transform.b3, transform.b4,
-        transform.c1, transform.c2, transform.c3, transform.c4,
-    };
 
-    dp::Primitive newPrimitive = {};
-    newPrimitive.materialIndex = mesh->mMaterialIndex;
+    auto& newPrimitive = newMesh.primitives.emplace_back();
+    newPrimitive.materialIndex = static_cast<dp::Index>(mesh->mMaterialIndex);
 
-    for (int i = 0; i < mesh->mNumVertices; i++) {
-        dp::Vertex vertex;
+    const auto* meshVertices = mesh->mVertices;
+    const auto* meshUvs = mesh->mTextureCoords[0];
+    newPrimitive.vertices.resize(mesh->mNumVertices);
+    for (uint32_t i = 0; i < mesh->mNumVertices; i++) {
+        auto& vertex = newPrimitive.vertices[i];
         vertex.pos = glm::vec3(meshVertices[i].x, meshVertices[i].y, meshVertices[i].z);
         if (mesh->HasNormals()) {
             vertex.normals = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
         }
-        vertex.uv = mesh->mTextureCoords[0] == nullptr
-                    ? glm::vec2(0.0)
-                    : glm::vec2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y),
-            newPrimitive.vertices.push_back(vertex);
+        if (meshUvs != nullptr) {
+            vertex.uv = glm::vec2(meshUvs[i].x, meshUvs[i].y);
+        }
     }
 
-    for (int i = 0; i < mesh->mNumFaces; i++) {
-        for (int j = 0; j < meshFaces[i].mNumIndices; j++) {
-            aiFace face = meshFaces[i];
-            newPrimitive.indices.push_back(face.mIndices[j]);
-        }
+    // Count the indices first, so that we only allocate once.
+    size_t indexCount = 0;
+    for (uint32_t i = 0; i < mesh->mNumFaces; i++) {
+        indexCount += mesh->mFaces[i].mNumIndices;
     }
+    newPrimitive.indices.resize(indexCount);
 
-    newMesh.primitives.push_back(newPrimitive);
-    meshes.push_back(newMesh);
+    auto* indices = newPrimitive.indices.data();
+    for (uint32_t i = 0; i < mesh->mNumFaces; i++) {
+        const aiFace& face = mesh->mFaces[i];
+        indices = std::copy_n(face.mIndices, face.mNumIndices, indices);
+    }
 }
 
-void dp::FileLoader::loadAssimpNode(const aiNode* node, const aiScene* scene) {
+void dp::FileLoader::loadAssimpNode(const aiNode* node, const aiMatrix4x4& parentTransform, const aiScene* scene,
+                                    std::vector<int32_t>& meshIndices, std::vector<const aiMesh*>& meshJobs) {
+    const aiMatrix4x4 transform = parentTransform * node->mTransformation;
+
     if (node->mMeshes != nullptr) {
-        for (int i = 0; i < node->mNumMeshes; i++) {
-            loadAssimpMesh(scene->mMeshes[node->mMeshes[i]], node->mTransformation, scene);
+        for (uint32_t i = 0; i < node->mNumMeshes; i++) {
+            const aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+            if (!mesh->HasFaces())
+                continue;
+
+            auto& meshIndex = meshIndices[node->mMeshes[i]];
+            if (meshIndex < 0) {
+                meshIndex = static_cast<int32_t>(meshes.size() + meshJobs.size());
+                meshJobs.push_back(mesh);
+            }
+            instances.push_back({
+                .transform = {
+                    transform.a1, transform.a2, transform.a3, transform.a4,
+                    transform.b1, transform.b2, transform.b3, transform.b4,
+                    transform.c1, transform.c2, transform.c3, transform.c4,
+                },
+                .meshIndex = static_cast<uint32_t>(meshIndex),
+            });
         }
     }
 
     if (node->mChildren != nullptr) {
-        for (int i = 0; i < node->mNumChildren; i++) {
-            loadAssimpNode(node->mChildren[i], scene);
+        for (uint32_t i = 0; i < node->mNumChildren; i++) {
+            loadAssimpNode(node->mChildren[i], transform, scene, meshIndices, meshJobs);
         }
     }
 }
@@ -75,55 +132,31 @@ void dp::FileLoader::loadAssimpNode(const aiNode* node, const aiScene* scene) {
 int32_t dp::FileLoader::loadAssimpTexture(const std::string& path) {
     fs::path filepath = path;
     // Check if a texture with the same filepath already exists
-    for (auto tex : textures) {
-        if (tex.filePath == filepath) {
-            return static_cast<int32_t>(&tex - &textures[0]);
-        }
+    if (auto it = textureIndices.find(path); it != textureIndices.end()) {
+        return it->second;
     }
 
-    dp::TextureFile textureFile;
-    textureFile.filePath = filepath;
     std::string extension = filepath.extension().string();
     // Convert extension to lower case.
     std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) {
         return std::tolower(c);
     });
 
-    if (extension == ".dds") {
-        dds::Image ddsImage;
-        dds::ReadResult result = dds::readFile(filepath.string().c_str(), &ddsImage);
-        if (result != dds::ReadResult::Success) {
-            fmt::print(stderr, "Failed to read DDS file: {}", result);
-            return false;
-        }
-        textureFile.width = ddsImage.width;
-        textureFile.height = ddsImage.height;
-        textureFile.format = dds::getVulkanFormat(ddsImage.format, ddsImage.supportsAlpha);
-        textureFile.mipLevels = ddsImage.numMips;
-        textureFile.pixels.assign(ddsImage.data.begin(), ddsImage.data.end());
-    } else if (extension == ".png" || extension == ".jpg" || extension == ".bmp") {
-        // STB supports JPG, PNG, TGA, BMP, PSD, GIF, HDR, PIC.
-        int tWidth, tHeight, channels; // Channels should always be 4 because we ask STB for RGBA.
-        stbi_uc* stbPixels = stbi_load(filepath.string().c_str(), &tWidth, &tHeight, &channels, STBI_rgb_alpha);
-        if (!stbPixels) {
-            fmt::print(stderr, "Failed to load texture file {}\n", path);
-            return false;
-        }
-        textureFile.width = tWidth;
-        textureFile.height = tHeight;
-        textureFile.format = VK_FORMAT_R8G8B8A8_SRGB; // The format STB uses.
-        textureFile.pixels.resize(tWidth * tHeight * 4);
-
-        textureFile.mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(tWidth, tHeight))));
-
-        memcpy(textureFile.pixels.data(), stbPixels, textureFile.pixels.size());
-
-        stbi_image_free(stbPixels);
-    } else {
+    // STB supports JPG, PNG, TGA, BMP, PSD, GIF, HDR, PIC.
+    if (extension != ".dds" && extension != ".png" && extension != ".jpg" && extension != ".bmp") {
         return false;
     }
 
+    // The actual decoding is deferred until all materials have been read.
+    dependencies.push_back(filepath);
+    dp::TextureFile textureFile;
+    textureFile.filePath = filepath;
     textures.push_back(textureFile);
+    pendingTextures.push_back({
+        .textureIndex = textures.size() - 1,
+        .filePath = filepath,
+    });
+    textureIndices[path] = static_cast<int32_t>(textures.size() - 1);
     return static_cast<int32_t>(textures.size() - 1);
 }
 
@@ -131,36 +164,162 @@ int32_t dp::FileLoader::loadEmbeddedAssimpTexture(const aiTexture* texture) {
     // Check if a texture with the same filepath already exists
     std::string textureFileName = texture->mFilename.C_Str();
     if (!textureFileName.empty()) { // Embedded textures might not be named in some formats
-        for (auto tex: textures) {
-            if (strcmp(reinterpret_cast<const char*>(tex.filePath.c_str()), textureFileName.c_str()) == 0) {
-                return static_cast<int32_t>(&tex - &textures[0]);
-            }
+        if (auto it = textureIndices.find(textureFileName); it != textureIndices.end()) {
+            return it->second;
         }
     }
 
-    int tWidth, tHeight, channels;
-    stbi_uc* pixels;
-    if (texture->mHeight == 0) {
-        pixels = stbi_load_from_memory(reinterpret_cast<unsigned char*>(texture->pcData), static_cast<int>(texture->mWidth), &tWidth, &tHeight, &channels, STBI_rgb_alpha);
+    dp::TextureFile textureFile;
+    textureFile.filePath = texture->mFilename.C_Str();
+    textures.push_back(textureFile);
+
+    // The embedded data is owned by the aiScene, which is gone by the time the textures are decoded.
+    const auto* data = reinterpret_cast<const uint8_t*>(texture->pcData);
+    const size_t dataSize = texture->mHeight == 0 ? texture->mWidth : texture->mWidth * texture->mHeight;
+    pendingTextures.push_back({
+        .textureIndex = textures.size() - 1,
+        .filePath = textureFile.filePath,
+        .data = std::vector<uint8_t>(data, data + dataSize),
+    });
+    if (!textureFileName.empty())
+        textureIndices[textureFileName] = static_cast<int32_t>(textures.size() - 1);
+    return static_cast<int32_t>(textures.size() - 1);
+}
+
+void dp::FileLoader::hashTexture(dp::TextureFile& texture) {
+    struct {
+        uint32_t width, height, mipLevels;
+        VkFormat format;
+    } properties = { texture.width, texture.height, texture.mipLevels, texture.format };
+    texture.contentHash = dp::hashBytes(texture.pixels.data(), texture.pixels.size(),
+                                        dp::hashValue(properties));
+}
+
+void dp::FileLoader::hashTextures() {
+    auto& pool = getThreadPool();
+    std::vector<std::future<void>> results;
+    results.reserve(textures.size());
+    for (auto& texture : textures) {
+        results.push_back(pool.submit([&texture]() {
+            hashTexture(texture);
+        }));
+    }
+    for (auto& result : results) {
+        result.get();
+    }
+}
+
+auto dp::FileLoader::getThreadPool() -> dp::ThreadPool& {
+    if (threadPool == nullptr)
+        threadPool = std::make_shared<dp::ThreadPool>();
+    return *threadPool;
+}
+
+bool dp::FileLoader::decodeTexture(const PendingTexture& pending, dp::TextureFile& textureFile) {
+    int tWidth, tHeight, channels; // Channels should always be 4 because we ask STB for RGBA.
+    stbi_uc* stbPixels;
+    if (!pending.data.empty()) {
+        stbPixels = stbi_load_from_memory(pending.data.data(), static_cast<int>(pending.data.size()), &tWidth, &tHeight, &channels, STBI_rgb_alpha);
     } else {
-        pixels = stbi_load_from_memory(reinterpret_cast<unsigned char*>(texture->pcData), static_cast<int>(texture->mWidth * texture->mHeight), &tWidth, &tHeight, &channels, STBI_rgb_alpha);
+        std::string extension = pending.filePath.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) {
+            return std::tolower(c);
+        });
+
+        if (extension == ".dds") {
+            dds::Image ddsImage;
+            dds::ReadResult result = dds::readFile(pending.filePath.string().c_str(), &ddsImage);
+            if (result != dds::ReadResult::Success) {
+                fmt::print(stderr, "Failed to read DDS file: {}", result);
+                return false;
+            }
+            textureFile.width = ddsImage.width;
+            textureFile.height = ddsImage.height;
+            textureFile.format = dds::getVulkanFormat(ddsImage.format, ddsImage.supportsAlpha);
+            textureFile.mipLevels = ddsImage.numMips;
+            textureFile.pixels.assign(ddsImage.data.begin(), ddsImage.data.end());
+            return true;
+        }
+
+        stbPixels = stbi_load(pending.filePath.string().c_str(), &tWidth, &tHeight, &channels, STBI_rgb_alpha);
+        if (stbPixels) {
+            textureFile.mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(tWidth, tHeight))));
+        }
     }
-    if (!pixels) {
-        fmt::print(stderr, "Failed to load texture file {}\n", texture->mFilename.C_Str());
+
+    if (!stbPixels) {
+        fmt::print(stderr, "Failed to load texture file {}\n", pending.filePath.string());
         return false;
     }
 
-    dp::TextureFile textureFile;
-    textureFile.filePath = texture->mFilename.C_Str();
     textureFile.width = tWidth;
     textureFile.height = tHeight;
-    textureFile.format = VK_FORMAT_R8G8B8A8_SRGB;
+    textureFile.format = VK_FORMAT_R8G8B8A8_SRGB; // The format STB uses.
+    textureFile.pixels.assign(stbPixels, stbPixels + static_cast<size_t>(tWidth) * tHeight * 4);
 
-    textureFile.pixels.resize(tWidth * tHeight * 4);
-    memcpy(textureFile.pixels.data(), pixels, textureFile.pixels.size());
+    stbi_image_free(stbPixels);
+    return true;
+}
 
-    textures.push_back(textureFile);
-    return static_cast<int32_t>(textures.size() - 1);
+void dp::FileLoader::decodePendingTextures(dp::BinaryFileWriter& cacheWriter) {
+    auto& pool = getThreadPool();
+
+    struct DecodeResult {
+        bool success = false;
+        std::chrono::duration<double, std::milli> duration = {};
+    };
+
+    // The textures vector is not resized while decoding, so the references stay valid.
+    // Every texture is also hashed on the worker that decoded it.
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::future<DecodeResult>> results;
+    results.reserve(pendingTextures.size());
+    std::vector<int64_t> pendingIndices(textures.size(), -1);
+    for (const auto& pending : pendingTextures) {
+        pendingIndices[pending.textureIndex] = static_cast<int64_t>(results.size());
+        auto& textureFile = textures[pending.textureIndex];
+        results.push_back(pool.submit([&pending, &textureFile]() -> DecodeResult {
+            auto decodeStart = std::chrono::steady_clock::now();
+            bool success = decodeTexture(pending, textureFile);
+            hashTexture(textureFile);
+            return { success, std::chrono::steady_clock::now() - decodeStart };
+        }));
+    }
+
+    // The textures are handed on in order, each as soon as it has been decoded. Textures that share an
+    // image get their copy before the decoded one is handed on, as it might be moved from.
+    std::chrono::duration<double, std::milli> serialTime = {};
+    for (size_t i = 0; i < textures.size(); ++i) {
+        auto& textureFile = textures[i];
+        if (pendingIndices[i] >= 0) {
+            auto result = results[pendingIndices[i]].get();
+            serialTime += result.duration;
+            if (result.success) {
+                fmt::print("Decoded texture {} ({}x{}) in {:.2f}ms\n", textureFile.filePath.string(),
+                           textureFile.width, textureFile.height, result.duration.count());
+            }
+            for (auto copyIndex : pendingTextures[pendingIndices[i]].copyIndices) {
+                auto filePath = textures[copyIndex].filePath;
+                textures[copyIndex] = textureFile;
+                textures[copyIndex].filePath = filePath;
+            }
+        } else if (textureFile.pixels.empty()) {
+            // Textures without an image stay empty, but still need a hash.
+            hashTexture(textureFile);
+        }
+
+        if (cacheWriter.isOpen())
+            dp::SceneCache::writeTexture(cacheWriter, textureFile);
+        if (onTextureLoaded)
+            onTextureLoaded(textureFile);
+    }
+
+    if (!pendingTextures.empty()) {
+        std::chrono::duration<double, std::milli> wallTime = std::chrono::steady_clock::now() - start;
+        fmt::print("Decoded {} textures on {} threads in {:.2f}ms, {:.2f}ms of decode time in total\n",
+                   pendingTextures.size(), pool.getThreadCount(), wallTime.count(), serialTime.count());
+    }
+    pendingTextures.clear();
 }
 
 bool dp::FileLoader::loadAssimpFile(const fs::path& fileName) {
@@ -171,8 +330,29 @@ bool dp::FileLoader::loadAssimpFile(const fs::path& fileName) {
         return false;
     }
 
-    // Load Meshes
-    loadAssimpNode(scene->mRootNode, scene);
+    // Load Meshes. We first flatten the node tree into instances and a list of unique meshes,
+    // which we then convert in parallel, each into its own preallocated slot.
+    std::vector<int32_t> meshIndices(scene->mNumMeshes, -1);
+    std::vector<const aiMesh*> meshJobs;
+    loadAssimpNode(scene->mRootNode, aiMatrix4x4(), scene, meshIndices, meshJobs);
+
+    auto& pool = getThreadPool();
+    const size_t firstMesh = meshes.size();
+    meshes.resize(firstMesh + meshJobs.size());
+    // Batch small meshes together, as scenes might easily have thousands of them.
+    const size_t batchSize = std::max<size_t>(1, meshJobs.size() / (pool.getThreadCount() * 4));
+    std::vector<std::future<void>> batches;
+    for (size_t begin = 0; begin < meshJobs.size(); begin += batchSize) {
+        const size_t end = std::min(begin + batchSize, meshJobs.size());
+        batches.push_back(pool.submit([this, &meshJobs, firstMesh, begin, end]() {
+            for (size_t i = begin; i < end; ++i) {
+                loadAssimpMesh(meshJobs[i], meshes[firstMesh + i]);
+            }
+        }));
+    }
+    for (auto& batch : batches) {
+        batch.get();
+    }
 
     // Load Materials
     if (scene->HasMaterials()) {
@@ -211,47 +391,10 @@ bool dp::FileLoader::loadAssimpFile(const fs::path& fileName) {
 }
 
 
-void dp::FileLoader::loadGlftMesh(tinygltf::Model& model, const tinygltf::Mesh& mesh, const tinygltf::Node& node) {
+void dp::FileLoader::loadGlftMesh(tinygltf::Model& model, const tinygltf::Mesh& mesh) {
     dp::Mesh newMesh;
     newMesh.name = mesh.name;
 
-    auto translation = glm::vec3(0.0f);
-    if (node.translation.size() == 3) {
-        translation = glm::make_vec3(node.translation.data());
-    }
-    auto rotation = glm::mat4(1.0f);
-    if (node.rotation.size() == 4) {
-        glm::quat q = glm::make_quat(node.rotation.data());
-    }
-    auto scale = glm::vec3(1.0f);
-    if (node.scale.size() == 3) {
-        scale = glm::make_vec3(node.scale.data());
-    }
-    auto matrix = glm::mat4(1.0f);
-    if (node.matrix.size() == 16) {
-        matrix = glm::make_mat4x4(node.matrix.data());
-    }
-
-    glm::mat4 newMatrix = glm::translate(glm::mat4(1.0f), translation) * glm::mat4(rotation) * glm::scale(glm::mat4(1.0f), scale) * matrix;
-    newMesh.transform = {
-        newMatrix[0][0], newMatrix[1][0], newMatrix[2][0], newMatrix[3][0],
-        newMatrix[0][1], newMatrix[1][1], newMatrix[2][1], newMatrix[3][1],
-        newMatrix[0][2], newMatrix[1][2], newMatrix[2][2], newMatrix[3][2],
-    };
-
-    // Simple helper for writing a pointer of data into a vector. We specifically
-    // don't memcpy the data as the source data might be using a different type,
-    // e.g. short.
-    auto writeToVector = [&]<typename T, typename S>(const T* src, const uint32_t count, std::vector<S>& out) {
-        out.resize(count);
-        for (size_t i = 0; i < count; ++i)
-            out[i] = static_cast<T>(src[i]);
-    };
-
-    auto getTypeSizeInBytes = [](uint32_t type) -> int32_t {
-        return tinygltf::GetNumComponentsInType(type) * tinygltf::GetComponentSizeInBytes(TINYGLTF_COMPONENT_TYPE_FLOAT);
-    };
-
     for (const auto& primitive : mesh.primitives) {
         dp::Primitive newPrimitive = {};
         newPrimitive.materialIndex = primitive.material;
@@ -259,62 +402,27 @@ void dp::FileLoader::loadGlftMesh(tinygltf::Model& model, const tinygltf::Mesh&
         // Load primitive attributes (pos, normals, uv, ...)
         {
             // We require a position attribute.
-            if (primitive.attributes.find("POSITION") == primitive.attributes.end())
+            auto positionAttribute = primitive.attributes.find("POSITION");
+            if (positionAttribute == primitive.attributes.end())
                 continue;
 
-            // We will first load all the different buffers (possibly the same buffer at a different
-            // offset) and store them as pointers.
-            struct PrimitiveBufferValue {
-                const float* data = nullptr;
-                uint64_t stride = 0;
+            // Gets the stream of an attribute, which has no data if the primitive does not have it.
+            auto getAttributeStream = [&](const std::string& name) -> dp::AttributeStream {
+                auto attribute = primitive.attributes.find(name);
+                if (attribute == primitive.attributes.end())
+                    return {};
+                const auto& accessor = model.accessors[attribute->second];
+                const auto& bufferView = model.bufferViews[accessor.bufferView];
+                const auto* data = &(model.buffers[bufferView.buffer].data[accessor.byteOffset + bufferView.byteOffset]);
+                return { data, static_cast<size_t>(accessor.ByteStride(bufferView)) };
             };
 
-            // Vertex positions
-            uint32_t vertexCount;
-            PrimitiveBufferValue positions = {};
-            {
-                const auto& posAccessor = model.accessors[primitive.attributes.find("POSITION")->second];
-                const auto& posBufferView = model.bufferViews[posAccessor.bufferView];
-                positions.data = reinterpret_cast<const float*>(&(model.buffers[posBufferView.buffer].data[posAccessor.byteOffset + posBufferView.byteOffset]));
-                positions.stride = posAccessor.ByteStride(posBufferView)
-                    ? (posAccessor.ByteStride(posBufferView) / sizeof(float))
-                    : getTypeSizeInBytes(TINYGLTF_TYPE_VEC3);
-                vertexCount = posAccessor.count;
-            }
-
-            // Normals
-            PrimitiveBufferValue normals = {};
-            if (primitive.attributes.find("NORMAL") != primitive.attributes.end()) {
-                const auto& normalsAccessor = model.accessors[primitive.attributes.find("NORMAL")->second];
-                const auto& normalsBufferView = model.bufferViews[normalsAccessor.bufferView];
-                normals.data = reinterpret_cast<const float*>(&(model.buffers[normalsBufferView.buffer].data[normalsAccessor.byteOffset + normalsBufferView.byteOffset]));
-                normals.stride = normalsAccessor.ByteStride(normalsBufferView)
-                    ? (normalsAccessor.ByteStride(normalsBufferView) / sizeof(float))
-                    : getTypeSizeInBytes(TINYGLTF_TYPE_VEC3);
-            }
-
-            // Texture coordinates
-            PrimitiveBufferValue uvs = {};
-            if (primitive.attributes.find("TEXCOORD_0") != primitive.attributes.end()) {
-                const auto& uvsAccessor = model.accessors[primitive.attributes.find("TEXCOORD_0")->second];
-                const auto& uvsBufferView = model.bufferViews[uvsAccessor.bufferView];
-                uvs.data = reinterpret_cast<const float*>(&(model.buffers[uvsBufferView.buffer].data[uvsAccessor.byteOffset + uvsBufferView.byteOffset]));
-                uvs.stride = uvsAccessor.ByteStride(uvsBufferView)
-                    ? (uvsAccessor.ByteStride(uvsBufferView) / sizeof(float))
-                    : getTypeSizeInBytes(TINYGLTF_TYPE_VEC2);
-            }
-
-            // Get the data for each Vertex and store the data as a new Vertex.
-            for (size_t i = 0; i < vertexCount; ++i) {
-                dp::Vertex newVertex = {};
-                newVertex.pos = glm::make_vec3(&positions.data[i * positions.stride]);
-                if (normals.data != nullptr)
-                    newVertex.normals = glm::make_vec3(&normals.data[i * normals.stride]);
-                if (uvs.data != nullptr)
-                    newVertex.uv = glm::make_vec2(&uvs.data[i * uvs.stride]);
-
-                newPrimitive.vertices.push_back(newVertex);
-            }
+            // We allocate all vertices at once and then write them row by row, reading all three
+            // attributes of each vertex together.
+            const auto vertexCount = model.accessors[positionAttribute->second].count;
+            newPrimitive.vertices.resize(vertexCount);
+            dp::interleaveVertices(getAttributeStream("POSITION"), getAttributeStream("NORMAL"), getAttributeStream("TEXCOORD_0"),
+                                   vertexCount, newPrimitive.vertices.data());
         }
 
         // Indexed geometry is not a must and is not handled as an attribute for some reason...
@@ -324,23 +432,26 @@ void dp::FileLoader::loadGlftMesh(tinygltf::Model& model, const tinygltf::Mesh&
             const auto& buffer = model.buffers[bufferView.buffer];
 
             auto indexCount = static_cast<uint32_t>(accessor.count);
-            newPrimitive.indices.reserve(indexCount);
+            newPrimitive.indices.resize(indexCount);
 
             const void* dataPtr = &(buffer.data[accessor.byteOffset + bufferView.byteOffset]);
-            // The indices could be in a different format. In the future, we should convert these automatically to be safe.
+            // Index buffers are always tightly packed, so we can widen them in bulk.
             switch (accessor.componentType) {
-                case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT: {
-                    const auto* buf = static_cast<const dp::Index*>(dataPtr);
-                    writeToVector(buf, indexCount, newPrimitive.indices);
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: {
+                    widenIndices(static_cast<const uint32_t*>(dataPtr), indexCount, newPrimitive.indices.data());
                     break;
                 }
                 case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
-                    const auto* buf = static_cast<const uint16_t*>(dataPtr);
-                    writeToVector(buf, indexCount, newPrimitive.indices);
+                    widenIndices(static_cast<const uint16_t*>(dataPtr), indexCount, newPrimitive.indices.data());
+                    break;
+                }
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: {
+                    widenIndices(static_cast<const uint8_t*>(dataPtr), indexCount, newPrimitive.indices.data());
                     break;
                 }
                 default: {
                     fmt::print(stderr, "Index component type {} unsupported", accessor.componentType);
+                    newPrimitive.indices.clear();
                     break;
                 }
             }
@@ -349,29 +460,77 @@ void dp::FileLoader::loadGlftMesh(tinygltf::Model& model, const tinygltf::Mesh&
             newPrimitive.indexType = VK_INDEX_TYPE_NONE_KHR;
         }
 
-        newMesh.primitives.push_back(newPrimitive);
+        newMesh.primitives.push_back(std::move(newPrimitive));
     }
 
-    meshes.push_back(newMesh);
+    meshes.push_back(std::move(newMesh));
 }
 
-void dp::FileLoader::loadGltfNode(tinygltf::Model& model, const tinygltf::Node& node) {
-    // TODO: Add support for node matrices (rotation, translation, scale).
+void dp::FileLoader::loadGltfNode(tinygltf::Model& model, const tinygltf::Node& node, const glm::mat4& parentTransform,
+                                  std::vector<int32_t>& meshIndices) {
+    // A node either has a matrix, or any combination of translation, rotation and scale.
+    glm::mat4 localTransform = glm::mat4(1.0f);
+    if (node.matrix.size() == 16) {
+        localTransform = glm::make_mat4x4(node.matrix.data());
+    } else {
+        auto translation = glm::vec3(0.0f);
+        if (node.translation.size() == 3) {
+            translation = glm::make_vec3(node.translation.data());
+        }
+        auto rotation = glm::mat4(1.0f);
+        if (node.rotation.size() == 4) {
+            glm::quat q = glm::make_quat(node.rotation.data());
+            rotation = glm::mat4_cast(q);
+        }
+        auto scale = glm::vec3(1.0f);
+        if (node.scale.size() == 3) {
+            scale = glm::make_vec3(node.scale.data());
+        }
+        localTransform = glm::translate(glm::mat4(1.0f), translation) * rotation * glm::scale(glm::mat4(1.0f), scale);
+    }
+    const glm::mat4 transform = parentTransform * localTransform;
+
     if (node.mesh > -1) {
-        loadGlftMesh(model, model.meshes[node.mesh], node);
+        auto& meshIndex = meshIndices[node.mesh];
+        if (meshIndex < 0) {
+            meshIndex = static_cast<int32_t>(meshes.size());
+            loadGlftMesh(model, model.meshes[node.mesh]);
+        }
+        instances.push_back({
+            .transform = {
+                transform[0][0], transform[1][0], transform[2][0], transform[3][0],
+                transform[0][1], transform[1][1], transform[2][1], transform[3][1],
+                transform[0][2], transform[1][2], transform[2][2], transform[3][2],
+            },
+            .meshIndex = static_cast<uint32_t>(meshIndex),
+        });
     }
 
     for (auto i : node.children) {
-        loadGltfNode(model, model.nodes[i]);
+        loadGltfNode(model, model.nodes[i], transform, meshIndices);
     }
 }
 
+bool dp::FileLoader::deferGltfImage(tinygltf::Image* image, int imageIndex, std::string* err, std::string* warn,
+                                    int reqWidth, int reqHeight, const unsigned char* bytes, int size, void* userData) {
+    // The bytes are only valid for the duration of this callback, so we copy the
+    // still encoded image and decode it later, together with all other images.
+    auto* encodedImages = static_cast<std::vector<std::vector<uint8_t>>*>(userData);
+    if (encodedImages->size() <= static_cast<size_t>(imageIndex))
+        encodedImages->resize(imageIndex + 1);
+    (*encodedImages)[imageIndex].assign(bytes, bytes + size);
+    return true;
+}
+
 bool dp::FileLoader::loadGltfFile(const fs::path& fileName) {
     tinygltf::Model model;
     tinygltf::TinyGLTF loader;
     std::string err;
     std::string warn;
 
+    std::vector<std::vector<uint8_t>> encodedImages;
+    loader.SetImageLoader(deferGltfImage, &encodedImages);
+
     fs::path ext = fileName.extension();
     bool success = false;
     if (ext.compare(".glb") == 0) {
@@ -387,10 +546,27 @@ bool dp::FileLoader::loadGltfFile(const fs::path& fileName) {
     if (!success)
         return false;
 
+    // Buffers and images are either embedded, or files relative to the glTF file. The URIs are
+    // percent-encoded UTF-8, which tinygltf decodes the same way to find the files.
+    auto addDependency = [&](const std::string& uri) {
+        if (uri.empty() || uri.starts_with("data:"))
+            return;
+        std::string decodedUri;
+        tinygltf::URIDecode(uri, &decodedUri, nullptr);
+        dependencies.push_back(fileName.parent_path() / std::u8string(decodedUri.begin(), decodedUri.end()));
+    };
+    for (const auto& buffer : model.buffers) {
+        addDependency(buffer.uri);
+    }
+    for (const auto& image : model.images) {
+        addDependency(image.uri);
+    }
+
     const tinygltf::Scene& scene = model.scenes[model.defaultScene];
     // Load all nodes
+    std::vector<int32_t> meshIndices(model.meshes.size(), -1);
     for (auto node : scene.nodes) {
-        loadGltfNode(model, model.nodes[node]);
+        loadGltfNode(model, model.nodes[node], glm::mat4(1.0f), meshIndices);
     }
 
     // Load materials
@@ -434,16 +610,29 @@ bool dp::FileLoader::loadGltfFile(const fs::path& fileName) {
         materials.push_back(material);
     }
 
-    // Load textures
+    // Load textures. Every image is only decoded once, even if multiple textures reference it.
+    // The textures are decoded after the geometry has been handed on.
+    textures.resize(model.textures.size());
+    std::vector<int64_t> imagePendingIndices(model.images.size(), -1);
     for (const auto& tex : model.textures) {
-        dp::TextureFile textureFile;
+        auto textureIndex = &tex - &model.textures[0];
+        if (tex.source < 0 || static_cast<size_t>(tex.source) >= encodedImages.size())
+            continue;
+
         const auto& image = model.images[tex.source];
-        textureFile.width = image.width;
-        textureFile.height = image.height;
-        textureFile.format = VK_FORMAT_R8G8B8A8_SRGB;
-        textureFile.pixels.resize(image.width * image.height * image.component);
-        memcpy(textureFile.pixels.data(), image.image.data(), textureFile.pixels.size());
-        textures.emplace_back(textureFile);
+        // Data URIs would make for a pretty long file name.
+        textures[textureIndex].filePath = image.uri.empty() || image.uri.starts_with("data:") ? image.name : image.uri;
+        auto& pendingIndex = imagePendingIndices[tex.source];
+        if (pendingIndex < 0) {
+            pendingIndex = static_cast<int64_t>(pendingTextures.size());
+            pendingTextures.push_back({
+                .textureIndex = static_cast<size_t>(textureIndex),
+                .filePath = textures[textureIndex].filePath,
+                .data = std::move(encodedImages[tex.source]),
+            });
+        } else {
+            pendingTextures[pendingIndex].copyIndices.push_back(static_cast<size_t>(textureIndex));
+        }
     }
 
     return true;
@@ -452,20 +641,42 @@ bool dp::FileLoader::loadGltfFile(const fs::path& fileName) {
 
 dp::FileLoader& dp::FileLoader::operator=(const dp::FileLoader& fileLoader) {
     meshes.assign(fileLoader.meshes.begin(), fileLoader.meshes.end());
+    instances.assign(fileLoader.instances.begin(), fileLoader.instances.end());
     materials.assign(fileLoader.materials.begin(), fileLoader.materials.end());
     textures.assign(fileLoader.textures.begin(), fileLoader.textures.end());
+    dependencies.assign(fileLoader.dependencies.begin(), fileLoader.dependencies.end());
     return *this;
 }
 
 bool dp::FileLoader::loadFile(const fs::path& fileName) {
     meshes.clear();
+    instances.clear();
     materials.clear();
     textures.clear();
+    dependencies.clear();
+    pendingTextures.clear();
+    textureIndices.clear();
 
     if (!fileName.has_extension()) {
         fmt::print("File path has no extension.\n");
         return false;
     }
+    auto start = std::chrono::steady_clock::now();
+    if (useSceneCache && dp::SceneCache::read(fileName, *this)) {
+        hashTextures();
+        std::chrono::duration<double, std::milli> loadTime = std::chrono::steady_clock::now() - start;
+        fmt::print("Finished loading file from scene cache in {:.2f}ms!\n", loadTime.count());
+
+        if (onGeometryLoaded)
+            onGeometryLoaded(*this);
+        if (onTextureLoaded) {
+            for (auto& texture : textures) {
+                onTextureLoaded(texture);
+            }
+        }
+        return true;
+    }
+
     fs::path ext = fileName.extension();
     bool ret;
     if (ext.compare(".glb") == 0 || ext.compare(".gltf") == 0) {
@@ -478,7 +689,25 @@ bool dp::FileLoader::loadFile(const fs::path& fileName) {
         fmt::print("Failed to load file!\n");
         return false;
     }
+    if (optimizeMeshes)
+        dp::MeshOptimizer::optimizeMeshes(meshes, getThreadPool());
+
+    std::chrono::duration<double, std::milli> geometryTime = std::chrono::steady_clock::now() - start;
+    fmt::print("Loaded the geometry in {:.2f}ms, decoding {} textures.\n", geometryTime.count(), pendingTextures.size());
 
-    fmt::print("Finished loading file!\n");
+    // The geometry is written to the cache before it is handed on, the textures follow as they are decoded.
+    dp::BinaryFileWriter cacheWriter;
+    if (useSceneCache)
+        dp::SceneCache::beginWrite(fileName, *this, cacheWriter);
+    if (onGeometryLoaded)
+        onGeometryLoaded(*this);
+    decodePendingTextures(cacheWriter);
+
+    std::chrono::duration<double, std::milli> loadTime = std::chrono::steady_clock::now() - start;
+    fmt::print("Finished loading file in {:.2f}ms!\n", loadTime.count());
+
+    if (cacheWriter.isOpen() && dp::SceneCache::endWrite(fileName, cacheWriter)) {
+        fmt::print("Wrote scene cache {}\n", dp::SceneCache::getCachePath(fileName).string());
+    }
     return true;
 }
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include <unordered_map>
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -8,11 +11,14 @@
 #include <tiny_gltf.h>
 
 #include "mesh.hpp"
+#include "../utils/thread_pool.hpp"
 #include "../vulkan/resource/texture.hpp"
 
 namespace fs = std::filesystem;
 
 namespace dp {
+    class BinaryFileWriter;
+
     /** A model loader dedicated to a single file (OBJ, FBX, GLTF, ...) */
     class FileLoader {
         static const uint32_t importFlags =
@@ -23,28 +29,100 @@ namespace dp {
             aiProcess_ValidateDataStructure |
             aiProcess_GenNormals;
 
+        /**
+         * A texture whose decoding has been deferred, so that all textures of a file
+         * can be decoded in parallel on the worker pool, after the geometry has been
+         * handed on. The encoded data is either read from filePath, or taken from data.
+         */
+        struct PendingTexture {
+            size_t textureIndex = 0;
+            fs::path filePath;
+            std::vector<uint8_t> data;
+            /** The later textures which use the same image, and get a copy once it has been decoded. */
+            std::vector<size_t> copyIndices;
+        };
+
+        std::shared_ptr<dp::ThreadPool> threadPool;
+        std::vector<PendingTexture> pendingTextures;
+        /** Texture indices by file path, to not load the same texture file twice. */
+        std::unordered_map<std::string, int32_t> textureIndices;
+
+        /** Gets the worker pool shared by all loading stages, creating it on first use. */
+        [[nodiscard]] auto getThreadPool() -> dp::ThreadPool&;
+
+        /** Decodes a single pending texture into given texture file. Returns false if failed. */
+        [[nodiscard]] static bool decodeTexture(const PendingTexture& pending, dp::TextureFile& textureFile);
+        /**
+         * Decodes all pending textures in parallel. Each texture is written to the cache, if the writer is
+         * open, and handed to onTextureLoaded in order of the texture indices, as soon as it has been decoded.
+         */
+        void decodePendingTextures(dp::BinaryFileWriter& cacheWriter);
+        /** Computes the content hash of a single texture. */
+        static void hashTexture(dp::TextureFile& texture);
+        /** Computes the content hash of all textures in parallel. */
+        void hashTextures();
+
         // ASSIMP
         [[nodiscard]] bool loadAssimpFile(const fs::path& fileName);
-        void loadAssimpMesh(const aiMesh* mesh, aiMatrix4x4 transform, const aiScene* scene);
-        void loadAssimpNode(const aiNode* node, const aiScene* scene);
+        /** Converts a single mesh into given output mesh. */
+        static void loadAssimpMesh(const aiMesh* mesh, dp::Mesh& newMesh);
+        /**
+         * Flattens the node tree into instances, accumulating the node transforms. Each referenced
+         * mesh with faces is added to meshJobs once, meshIndices maps the scene's mesh indices to them.
+         */
+        void loadAssimpNode(const aiNode* node, const aiMatrix4x4& parentTransform, const aiScene* scene,
+                            std::vector<int32_t>& meshIndices, std::vector<const aiMesh*>& meshJobs);
         /** Loads a texture into local memory. Returns 0 if failed, the texture index otherwise. */
         [[nodiscard]] int32_t loadAssimpTexture(const std::string& path);
         [[nodiscard]] int32_t loadEmbeddedAssimpTexture(const aiTexture* texture);
 
         // TINYGLTF
+        /** tinygltf image loader callback, which only stores the encoded bytes for decodePendingTextures. */
+        static bool deferGltfImage(tinygltf::Image* image, int imageIndex, std::string* err, std::string* warn,
+                                   int reqWidth, int reqHeight, const unsigned char* bytes, int size, void* userData);
         bool loadGltfFile(const fs::path& fileName);
-        void loadGlftMesh(tinygltf::Model& model, const tinygltf::Mesh& mesh, const tinygltf::Node& node);
-        void loadGltfNode(tinygltf::Model& model, const tinygltf::Node& node);
+        void loadGlftMesh(tinygltf::Model& model, const tinygltf::Mesh& mesh);
+        /**
+         * Adds an instance for the node and all of its children, accumulating the node transforms.
+         * Each mesh is only loaded once, meshIndices maps the glTF mesh indices to our meshes.
+         */
+        void loadGltfNode(tinygltf::Model& model, const tinygltf::Node& node, const glm::mat4& parentTransform,
+                          std::vector<int32_t>& meshIndices);
 
     public:
         std::vector<dp::Mesh> meshes;
+        std::vector<dp::MeshInstance> instances;
         std::vector<dp::Material> materials;
         std::vector<dp::TextureFile> textures;
+        /**
+         * The other files the loaded file references, like glTF buffers and texture files. The
+         * scene cache checks these for changes, as it only hashes the loaded file itself.
+         */
+        std::vector<fs::path> dependencies;
+
+        /** Whether to read from and write to a .dpscene cache next to the loaded file. */
+        bool useSceneCache = true;
+        /** Whether to optimize the meshes for vertex locality after loading. See dp::MeshOptimizer. */
+        bool optimizeMeshes = true;
+
+        /**
+         * Called once the meshes, materials and instances have been loaded, before any texture has been
+         * decoded. The textures already have their final count, but no pixels yet. May move out of the loader.
+         */
+        std::function<void(dp::FileLoader& loader)> onGeometryLoaded;
+        /** Called for each texture in order of the texture indices, once it has been decoded. May move from the texture. */
+        std::function<void(dp::TextureFile& texture)> onTextureLoaded;
 
         explicit FileLoader() = default;
         FileLoader(const FileLoader&) = default;
+        FileLoader(FileLoader&&) noexcept = default;
         FileLoader& operator=(const dp::FileLoader& fileLoader);
+        FileLoader& operator=(dp::FileLoader&&) noexcept = default;
 
+        /**
+         * Loads given file, calling onGeometryLoaded and then onTextureLoaded for every texture, if they are
+         * set. Returns false if the file could not be loaded, in which case neither of them has been called.
+         */
         bool loadFile(const fs::path& fileName);
     };
 }
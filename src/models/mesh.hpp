@@ -22,6 +22,22 @@ namespace dp {
         float padding = 1.0f;
     };
 
+    /**
+     * A compact vertex, with the full precision position, as that is the input for the AS build,
+     * an octahedral encoded normal as snorm16x2 and the UV as two halfs.
+     */
+    struct PackedVertex {
+        glm::fvec3 pos;
+        uint32_t normal;
+        uint32_t uv;
+    };
+
+    /** How the vertices of a primitive are laid out on the GPU. */
+    enum class VertexEncoding : uint32_t {
+        Full = 0, // dp::Vertex
+        Packed = 1, // dp::PackedVertex
+    };
+
     /**
      * Struct referencing buffer addresses for various mesh related buffers.
      * Used for the shader to obtain vertex and material data per primitive.
@@ -36,13 +52,17 @@ namespace dp {
         uint64_t meshBufferVertexOffset = 0;
         uint64_t meshBufferIndexOffset = 0;
         Index materialIndex = 0;
+        /** The size of a single index in bytes, either 2 or 4. */
+        uint32_t indexSize = sizeof(Index);
+        VertexEncoding vertexEncoding = VertexEncoding::Full;
+        uint32_t padding = 0;
     };
 
     struct Material {
         glm::vec3 baseColor = glm::vec3(1.0f);
         float metallicFactor = 1.0f;
         float roughnessFactor = 1.0f;
-        Index baseTextureIndex = -1; // -1 + 1 is 0, our default white image.
+        Index baseTextureIndex = -1; // -1 maps to our default white image.
         Index normalTextureIndex = -1;
         Index occlusionTextureIndex = -1;
         Index emissiveTextureIndex = -1;
@@ -56,6 +76,8 @@ namespace dp {
         uint32_t mipLevels = 1;
         std::vector<uint8_t> pixels = {};
         VkFormat format = VK_FORMAT_UNDEFINED;
+        /** Hash of the pixels and image properties, used to share identical textures on the GPU. */
+        uint64_t contentHash = 0;
     };
 
     /**
@@ -67,23 +89,47 @@ namespace dp {
         std::vector<Index> indices = {};
         /** Accessed through gl_InstanceCustomIndexEXT and gl_GeometryIndexEXT. */
         Index materialIndex = 0;
-        /* Can be set to VK_INDEX_TYPE_NONE_KHR if no indices are provided. */
+        /**
+         * The type of the indices on the GPU. Can be set to VK_INDEX_TYPE_NONE_KHR if no indices are
+         * provided. Otherwise, this is compacted to VK_INDEX_TYPE_UINT16 when the mesh buffers are
+         * created if all vertices are addressable with 16 bits.
+         */
         VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+        /** The layout of the vertices on the GPU, which is set when the mesh buffers are created. */
+        VertexEncoding vertexEncoding = VertexEncoding::Full;
         static const VkFormat vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
-        static constexpr uint32_t vertexStride = sizeof(Vertex);
         /** These are offsets into the resulting mesh buffer for
          * specifically this primitive. */
         uint64_t meshBufferVertexOffset;
         uint64_t meshBufferIndexOffset;
+
+        /** Gets the size of a single index on the GPU, in bytes. */
+        [[nodiscard]] auto getIndexSize() const -> uint32_t {
+            return indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(Index);
+        }
+
+        /** Gets the size of a single vertex on the GPU, in bytes. */
+        [[nodiscard]] auto getVertexStride() const -> uint32_t {
+            return vertexEncoding == VertexEncoding::Packed ? sizeof(PackedVertex) : sizeof(Vertex);
+        }
     };
 
     struct Mesh {
         std::string name = {};
         std::vector<dp::Primitive> primitives = {};
+    };
+
+    /**
+     * A placement of a mesh in the scene. Meshes referenced by multiple nodes are only stored,
+     * and built into a BLAS, once, with one instance per node.
+     */
+    struct MeshInstance {
         VkTransformMatrixKHR transform = {
             1.0, 0.0, 0.0, 0.0,
             0.0, 1.0, 0.0, 0.0,
             0.0, 0.0, 1.0, 0.0
         };
+        /** Index into the meshes of the scene. */
+        uint32_t meshIndex = 0;
     };
 }
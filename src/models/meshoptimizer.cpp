@@ -0,0 +1,195 @@
+#include "meshoptimizer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <limits>
+
+#include <fmt/core.h>
+
+#include "../utils/thread_pool.hpp"
+
+void dp::MeshOptimizer::Statistics::add(const Statistics& other) {
+    primitiveCount += other.primitiveCount;
+    triangleCount += other.triangleCount;
+    cacheMissesBefore += other.cacheMissesBefore;
+    cacheMissesAfter += other.cacheMissesAfter;
+    vertexCountBefore += other.vertexCountBefore;
+    vertexCountAfter += other.vertexCountAfter;
+}
+
+auto dp::MeshOptimizer::reorderTriangles(const std::vector<dp::Index>& indices, size_t vertexCount) -> std::vector<dp::Index> {
+    // This implements "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw"
+    // by Sander et al., also known as Tipsify.
+    constexpr size_t noVertex = std::numeric_limits<size_t>::max();
+    const size_t triangleCount = indices.size() / 3;
+
+    // Build the list of adjacent triangles for each vertex, all stored in a single array.
+    std::vector<uint32_t> liveTriangles(vertexCount, 0);
+    for (auto index : indices) {
+        ++liveTriangles[index];
+    }
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+    for (size_t i = 0; i < vertexCount; ++i) {
+        adjacencyOffsets[i + 1] = adjacencyOffsets[i] + liveTriangles[i];
+    }
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<uint32_t> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i) {
+        adjacency[adjacencyFill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    std::vector<uint32_t> cacheTimestamps(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> deadEndStack;
+    std::vector<uint32_t> candidates;
+    std::vector<dp::Index> result;
+    result.reserve(indices.size());
+
+    uint32_t timestamp = cacheSize + 1;
+    size_t cursor = 0;
+    size_t fanningVertex = vertexCount > 0 ? 0 : noVertex;
+    while (fanningVertex != noVertex) {
+        // Emit all remaining triangles around the fanning vertex.
+        candidates.clear();
+        for (uint32_t i = adjacencyOffsets[fanningVertex]; i < adjacencyOffsets[fanningVertex + 1]; ++i) {
+            const uint32_t triangle = adjacency[i];
+            if (emitted[triangle])
+                continue;
+            emitted[triangle] = true;
+
+            for (size_t j = 0; j < 3; ++j) {
+                const auto vertex = static_cast<uint32_t>(indices[triangle * 3 + j]);
+                result.push_back(static_cast<dp::Index>(vertex));
+                deadEndStack.push_back(vertex);
+                candidates.push_back(vertex);
+                --liveTriangles[vertex];
+                if (timestamp - cacheTimestamps[vertex] > cacheSize) {
+                    cacheTimestamps[vertex] = timestamp++;
+                }
+            }
+        }
+
+        // Continue with the candidate that will still be in the cache after emitting all of its
+        // remaining triangles, preferring the oldest one.
+        size_t nextVertex = noVertex;
+        int64_t bestPriority = -1;
+        for (auto vertex : candidates) {
+            if (liveTriangles[vertex] == 0)
+                continue;
+
+            int64_t priority = 0;
+            const uint32_t age = timestamp - cacheTimestamps[vertex];
+            if (age + 2 * liveTriangles[vertex] <= cacheSize)
+                priority = age;
+            if (priority > bestPriority) {
+                bestPriority = priority;
+                nextVertex = vertex;
+            }
+        }
+
+        // On a dead end, go back to the most recently used vertex with remaining triangles,
+        // or to the next vertex in input order.
+        while (nextVertex == noVertex && !deadEndStack.empty()) {
+            const auto vertex = deadEndStack.back();
+            deadEndStack.pop_back();
+            if (liveTriangles[vertex] > 0)
+                nextVertex = vertex;
+        }
+        for (; nextVertex == noVertex && cursor < vertexCount; ++cursor) {
+            if (liveTriangles[cursor] > 0)
+                nextVertex = cursor;
+        }
+        fanningVertex = nextVertex;
+    }
+    return result;
+}
+
+auto dp::MeshOptimizer::remapVertices(dp::Primitive& primitive) -> size_t {
+    constexpr uint32_t unmapped = std::numeric_limits<uint32_t>::max();
+
+    std::vector<uint32_t> remap(primitive.vertices.size(), unmapped);
+    uint32_t vertexCount = 0;
+    for (auto& index : primitive.indices) {
+        auto& mapped = remap[index];
+        if (mapped == unmapped)
+            mapped = vertexCount++;
+        index = static_cast<dp::Index>(mapped);
+    }
+
+    std::vector<dp::Vertex> vertices(vertexCount);
+    for (size_t i = 0; i < remap.size(); ++i) {
+        if (remap[i] != unmapped)
+            vertices[remap[i]] = primitive.vertices[i];
+    }
+    primitive.vertices = std::move(vertices);
+    return vertexCount;
+}
+
+auto dp::MeshOptimizer::computeCacheMisses(const std::vector<dp::Index>& indices, size_t vertexCount) -> uint64_t {
+    std::vector<uint32_t> cacheTimestamps(vertexCount, 0);
+    uint32_t timestamp = cacheSize + 1;
+    uint64_t misses = 0;
+    for (auto index : indices) {
+        if (timestamp - cacheTimestamps[index] > cacheSize) {
+            cacheTimestamps[index] = timestamp++;
+            ++misses;
+        }
+    }
+    return misses;
+}
+
+auto dp::MeshOptimizer::optimizePrimitive(dp::Primitive& primitive) -> Statistics {
+    Statistics statistics = {};
+    if (primitive.indexType == VK_INDEX_TYPE_NONE_KHR || primitive.indices.empty() || primitive.indices.size() % 3 != 0)
+        return statistics;
+
+    const size_t vertexCount = primitive.vertices.size();
+    const bool validIndices = std::all_of(primitive.indices.begin(), primitive.indices.end(), [&](dp::Index index) {
+        return index >= 0 && static_cast<size_t>(index) < vertexCount;
+    });
+    if (!validIndices)
+        return statistics;
+
+    statistics.primitiveCount = 1;
+    statistics.triangleCount = primitive.indices.size() / 3;
+    statistics.vertexCountBefore = vertexCount;
+    statistics.cacheMissesBefore = computeCacheMisses(primitive.indices, vertexCount);
+
+    primitive.indices = reorderTriangles(primitive.indices, vertexCount);
+    statistics.cacheMissesAfter = computeCacheMisses(primitive.indices, vertexCount);
+    statistics.vertexCountAfter = remapVertices(primitive);
+    return statistics;
+}
+
+void dp::MeshOptimizer::optimizeMeshes(std::vector<dp::Mesh>& meshes, dp::ThreadPool& threadPool) {
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::future<Statistics>> results;
+    for (auto& mesh : meshes) {
+        for (auto& primitive : mesh.primitives) {
+            results.push_back(threadPool.submit([&primitive]() {
+                return optimizePrimitive(primitive);
+            }));
+        }
+    }
+
+    Statistics total = {};
+    for (auto& result : results) {
+        total.add(result.get());
+    }
+
+    if (total.triangleCount == 0)
+        return;
+
+    std::chrono::duration<double, std::milli> optimizeTime = std::chrono::steady_clock::now() - start;
+    auto toMiB = [](uint64_t vertexCount) {
+        return static_cast<double>(vertexCount * sizeof(dp::Vertex)) / (1024.0 * 1024.0);
+    };
+    fmt::print("Optimized {} primitives in {:.2f}ms: ACMR {:.3f} -> {:.3f}, {} -> {} vertices ({:.2f} -> {:.2f} MiB)\n",
+               total.primitiveCount, optimizeTime.count(),
+               static_cast<double>(total.cacheMissesBefore) / static_cast<double>(total.triangleCount),
+               static_cast<double>(total.cacheMissesAfter) / static_cast<double>(total.triangleCount),
+               total.vertexCountBefore, total.vertexCountAfter,
+               toMiB(total.vertexCountBefore), toMiB(total.vertexCountAfter));
+}
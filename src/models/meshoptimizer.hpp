@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+
+#include "mesh.hpp"
+
+namespace dp {
+    // fwd.
+    class ThreadPool;
+
+    /**
+     * Optimizes the primitives of a loaded scene for locality. The triangles get reordered with
+     * Tipsify, which optimizes for the vertex cache and, as it walks along adjacent triangles, also
+     * keeps spatially close triangles together. The vertices then get remapped into the order in
+     * which they are first used, dropping all unused vertices.
+     */
+    class MeshOptimizer {
+        /** Reorders the triangles of given indices, which all have to be smaller than vertexCount. */
+        [[nodiscard]] static auto reorderTriangles(const std::vector<dp::Index>& indices, size_t vertexCount) -> std::vector<dp::Index>;
+        /** Remaps the vertices into the order of first use. Returns the new vertex count. */
+        static auto remapVertices(dp::Primitive& primitive) -> size_t;
+
+    public:
+        /** The size of the simulated FIFO vertex cache, for both optimizing and computing the ACMR. */
+        static constexpr uint32_t cacheSize = 16;
+
+        struct Statistics {
+            uint64_t primitiveCount = 0;
+            uint64_t triangleCount = 0;
+            uint64_t cacheMissesBefore = 0;
+            uint64_t cacheMissesAfter = 0;
+            uint64_t vertexCountBefore = 0;
+            uint64_t vertexCountAfter = 0;
+
+            void add(const Statistics& other);
+        };
+
+        /** Computes the amount of vertex cache misses of given indices, for a FIFO cache of cacheSize. */
+        [[nodiscard]] static auto computeCacheMisses(const std::vector<dp::Index>& indices, size_t vertexCount) -> uint64_t;
+
+        /** Optimizes a single primitive. Primitives which aren't indexed triangle lists are left untouched. */
+        static auto optimizePrimitive(dp::Primitive& primitive) -> Statistics;
+        /** Optimizes all primitives of given meshes in parallel, and prints a report. */
+        static void optimizeMeshes(std::vector<dp::Mesh>& meshes, dp::ThreadPool& threadPool);
+    };
+}
@@ -1,34 +1,42 @@
 #include "modelmanager.hpp"
 
+#include <cmath>
+#include <cstring>
 #include <future>
 #include <thread>
 #include <fmt/core.h>
 
-#include "../vulkan/resource/stagingbuffer.hpp"
-#include "../vulkan/resource/texture.hpp"
 #include "../vulkan/context.hpp"
+#include "../vulkan/utils.hpp"
 #include "../engine.hpp"
 
 dp::ModelManager::ModelManager(const dp::Context& context, dp::Engine& engine)
-    : ctx(context), engine(engine), tlas(ctx),
+    : ctx(context), engine(engine), uploadBatch(ctx, "uploads"), textureRegistry(ctx, uploadBatch), tlasInstanceBuffer(ctx, "tlasInstanceBuffer"), tlas(ctx), scratchArena(ctx),
       materialBuffer(ctx, "materialBuffer"), instanceDescriptionBuffer(ctx, "instanceDescriptionBuffer") {
 }
 
 void dp::ModelManager::createDescriptionBuffers() {
-    materialBuffer.destroy();
-    instanceDescriptionBuffer.destroy();
-
-    // Because we always have an initial empty image, we increment the index by 1.
-    // The defaults of these values is -1, always resulting in an image index of 0.
-    for (auto& mat : fileLoader.materials) {
-        ++mat.baseTextureIndex;
-        ++mat.normalTextureIndex;
-        ++mat.emissiveTextureIndex;
-        ++mat.occlusionTextureIndex;
-        ++mat.pbrTextureIndex;
+    // The descriptor sets of the frames in flight still point to the previous buffers.
+    retire(materialBuffer);
+    retire(instanceDescriptionBuffer);
+
+    // Remap the texture indices of the scene to their slots inside the texture registry.
+    // The defaults of these values is -1, always resulting in the default white image.
+    auto toSlot = [this](dp::Index textureIndex) -> dp::Index {
+        if (textureIndex < 0 || static_cast<size_t>(textureIndex) >= sceneTextureSlots.size())
+            return dp::TextureRegistry::defaultSlot;
+        return static_cast<dp::Index>(sceneTextureSlots[textureIndex]);
+    };
+    std::vector<dp::Material> materials(sceneMaterials);
+    for (auto& mat : materials) {
+        mat.baseTextureIndex = toSlot(mat.baseTextureIndex);
+        mat.normalTextureIndex = toSlot(mat.normalTextureIndex);
+        mat.emissiveTextureIndex = toSlot(mat.emissiveTextureIndex);
+        mat.occlusionTextureIndex = toSlot(mat.occlusionTextureIndex);
+        mat.pbrTextureIndex = toSlot(mat.pbrTextureIndex);
     }
 
-    auto materialSize = fileLoader.materials.size() * sizeof(Material);
+    auto materialSize = materials.size() * sizeof(Material);
     materialBuffer.create(
         std::max(materialSize, static_cast<uint64_t>(1)),
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
@@ -36,14 +44,12 @@ void dp::ModelManager::createDescriptionBuffers() {
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
     );
     if (materialSize != 0)
-        materialBuffer.memoryCopy(fileLoader.materials.data(), materialSize);
+        materialBuffer.memoryCopy(materials.data(), materialSize);
 
     // Create the instance and geometry descriptions.
     instanceDescriptions.clear();
     instanceDescriptions.resize(blases.size());
     for (auto& blas : blases) {
-        blas.createGeometryDescriptionBuffer();
-
         InstanceDescription desc = {
             .vertexBufferAddress = blas.vertexBuffer.getDeviceAddress(),
             .indexBufferAddress = blas.indexBuffer.getDeviceAddress(),
@@ -65,121 +71,298 @@ void dp::ModelManager::createDescriptionBuffers() {
         instanceDescriptionBuffer.memoryCopy(instanceDescriptions.data(), descriptionSize);
 }
 
-void dp::ModelManager::buildBlases() {
+void dp::ModelManager::buildBlases(std::vector<dp::Mesh>& meshes) {
     VkPhysicalDeviceProperties2 deviceProperties = {
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
         .pNext = &this->asProperties,
     };
     vkGetPhysicalDeviceProperties2(ctx.physicalDevice, &deviceProperties);
 
-    // We store all relevant data we need for the build dispatch, as we use a single build
-    // dispatch for all BLASes we build and the data would obviously otherwise get invalidated
+    // We store all relevant data we need for the build dispatches, as we build many BLASes
+    // with a single dispatch and the data would obviously otherwise get invalidated
     // at the end of the scope for the for-loop or the lambda.
     std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildGeometryInfos = {};
     std::vector<std::vector<VkAccelerationStructureBuildRangeInfoKHR>> rangeInfos = {};
     std::vector<VkAccelerationStructureBuildRangeInfoKHR*> rangeInfoPointers = {};
     std::vector<std::vector<VkAccelerationStructureGeometryKHR>> geometries = {};
 
-    ctx.oneTimeSubmit(ctx.graphicsQueue, ctx.commandPool, [&](VkCommandBuffer cmdBuffer) {
-        buildGeometryInfos.resize(fileLoader.meshes.size());
-        rangeInfos.resize(fileLoader.meshes.size());
-        geometries.resize(fileLoader.meshes.size());
-
-        for (auto& tMesh : fileLoader.meshes) {
-            uint64_t meshIndex = &tMesh - &fileLoader.meshes[0];
-
-            // We move each mesh into the corresponding BLAS struct, therefore, fileLoader.meshes might have
-            // useless values.
-            dp::BottomLevelAccelerationStructure blas(ctx, std::move(tMesh));
-            fmt::print("Building BLAS {}\n", blas.mesh.name);
-
-            blas.createMeshBuffers();
-
-            std::vector<uint32_t> primitiveCounts(blas.mesh.primitives.size());
-            rangeInfos[meshIndex].resize(blas.mesh.primitives.size());
-            geometries[meshIndex].resize(blas.mesh.primitives.size());
-            for (const auto& prim : blas.mesh.primitives) {
-                uint64_t primitiveIndex = &prim - &blas.mesh.primitives[0];
-
-                primitiveCounts[primitiveIndex] = std::min(prim.indices.size() / 3, asProperties.maxPrimitiveCount);
-                geometries[meshIndex][primitiveIndex] = {
-                     .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
-                     .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
-                     .geometry = {
-                         .triangles = {
-                             .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
-                             .vertexFormat = dp::Primitive::vertexFormat,
-                             .vertexData {
-                                 .deviceAddress = blas.vertexBuffer.getDeviceAddress() + prim.meshBufferVertexOffset,
-                             },
-                             .vertexStride = dp::Primitive::vertexStride,
-                             .maxVertex = static_cast<uint32_t>(prim.vertices.size() - 1),
-                             .indexType = prim.indexType,
-                             .indexData = {
-                                 .deviceAddress = blas.indexBuffer.getDeviceAddress() + prim.meshBufferIndexOffset,
-                             },
-                             .transformData = {
-                                 .deviceAddress = blas.transformBuffer.getDeviceAddress(),
+    // Our meshes are static, so compacted structures are built without the update bit,
+    // which would only make them larger.
+    const bool compact = engine.options.compactAccelerationStructures && !meshes.empty();
+    const VkBuildAccelerationStructureFlagsKHR buildFlags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR
+        | (compact ? VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR : VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR);
+
+    VkQueryPool queryPool = nullptr;
+    if (compact) {
+        VkQueryPoolCreateInfo queryPoolInfo = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+            .queryCount = static_cast<uint32_t>(meshes.size()),
+        };
+        auto result = vkCreateQueryPool(ctx.device, &queryPoolInfo, nullptr, &queryPool);
+        checkResult(ctx, result, "Failed to create compacted size query pool");
+    }
+
+    const size_t firstBlas = blases.size();
+    const auto vertexEncoding = engine.options.compactVertices ? dp::VertexEncoding::Packed : dp::VertexEncoding::Full;
+    buildGeometryInfos.resize(meshes.size());
+    rangeInfos.resize(meshes.size());
+    rangeInfoPointers.resize(meshes.size());
+    geometries.resize(meshes.size());
+
+    // The size of the vertex and index buffers of a mesh, before its indices get compacted.
+    auto getMeshBufferSize = [&](const dp::Mesh& mesh) {
+        VkDeviceSize size = 0;
+        for (const auto& prim : mesh.primitives) {
+            size += prim.vertices.size() * (vertexEncoding == dp::VertexEncoding::Packed ? sizeof(dp::PackedVertex) : sizeof(dp::Vertex));
+            size += dp::Buffer::alignedSize(prim.indices.size() * sizeof(dp::Index), sizeof(uint32_t));
+        }
+        return size;
+    };
+
+    // The meshes are built in batches, which are submitted one after another through the upload
+    // batch, together with any textures recorded this frame. A batch ends once the staging ring is
+    // full, and every batch only uses a part of the device memory that is still available, so that
+    // scenes that don't fit into memory as a whole still load.
+    size_t nextMesh = 0, batchCount = 0, groupCount = 0;
+    dp::UploadToken buildToken = 0;
+    while (nextMesh < meshes.size()) {
+        const size_t batchStart = nextMesh;
+        const auto deviceBudget = static_cast<VkDeviceSize>(static_cast<double>(ctx.getAvailableMemory()) * buildMemoryFraction);
+        VkDeviceSize batchDeviceSize = 0;
+
+        {
+            // The first mesh of a batch may wait for staging memory, which submits whatever has been
+            // recorded. Afterwards, the command buffer stays the same until the batch is submitted.
+            const auto firstStaging = uploadBatch.allocate(dp::BottomLevelAccelerationStructure::getStagingSize(meshes[batchStart], vertexEncoding));
+            VkCommandBuffer cmdBuffer = uploadBatch.getCommandBuffer();
+
+            // The BLASes are built in groups, whose scratch memory stays within the budget of the
+            // scratch arena. Every group reuses the scratch memory of the group before it.
+            size_t groupStart = batchStart;
+            auto buildGroup = [&](size_t groupEnd) {
+                ctx.setCheckpoint(cmdBuffer, "Building BLASes!");
+                ctx.buildAccelerationStructures(cmdBuffer, static_cast<uint32_t>(groupEnd - groupStart),
+                                                &buildGeometryInfos[groupStart], &rangeInfoPointers[groupStart]);
+                groupStart = groupEnd;
+                ++groupCount;
+            };
+
+            for (; nextMesh < meshes.size(); ++nextMesh) {
+                const size_t meshIndex = nextMesh;
+
+                // Every batch builds at least one mesh, even if it exceeds the budget on its own.
+                const VkDeviceSize meshBufferSize = getMeshBufferSize(meshes[meshIndex]);
+                if (meshIndex != batchStart && batchDeviceSize + meshBufferSize > deviceBudget)
+                    break;
+                auto staging = meshIndex == batchStart
+                    ? std::optional(firstStaging)
+                    : uploadBatch.tryAllocate(dp::BottomLevelAccelerationStructure::getStagingSize(meshes[meshIndex], vertexEncoding));
+                if (!staging.has_value())
+                    break;
+
+                // We move each mesh into the corresponding BLAS struct, therefore, meshes might have
+                // useless values. The BLAS holds the only host copy of the mesh until it is staged.
+                dp::BottomLevelAccelerationStructure blas(ctx, std::move(meshes[meshIndex]));
+                fmt::print("Building BLAS {}\n", blas.mesh.name);
+
+                blas.createMeshBuffers(vertexEncoding);
+
+                std::vector<uint32_t> primitiveCounts(blas.mesh.primitives.size());
+                rangeInfos[meshIndex].resize(blas.mesh.primitives.size());
+                geometries[meshIndex].resize(blas.mesh.primitives.size());
+                for (const auto& prim : blas.mesh.primitives) {
+                    uint64_t primitiveIndex = &prim - &blas.mesh.primitives[0];
+
+                    primitiveCounts[primitiveIndex] = std::min(prim.indices.size() / 3, asProperties.maxPrimitiveCount);
+                    geometries[meshIndex][primitiveIndex] = {
+                         .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+                         .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
+                         .geometry = {
+                             .triangles = {
+                                 .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+                                 .vertexFormat = dp::Primitive::vertexFormat,
+                                 .vertexData {
+                                     .deviceAddress = blas.vertexBuffer.getDeviceAddress() + prim.meshBufferVertexOffset,
+                                 },
+                                 .vertexStride = prim.getVertexStride(),
+                                 .maxVertex = static_cast<uint32_t>(prim.vertices.size() - 1),
+                                 .indexType = prim.indexType,
+                                 .indexData = {
+                                     .deviceAddress = blas.indexBuffer.getDeviceAddress() + prim.meshBufferIndexOffset,
+                                 },
+                                 // The transforms are part of the TLAS instances, as BLASes are shared.
+                                 .transformData = {},
                              },
-                         },
-                     }
+                         }
+                    };
+                    rangeInfos[meshIndex][primitiveIndex] = {
+                        .primitiveCount = static_cast<uint32_t>(primitiveCounts[primitiveIndex]),
+                        .primitiveOffset = 0, // This offsets both vertexData and indexData, however, we already do that ourselves.
+                        .firstVertex = 0,
+                        .transformOffset = 0,
+                    };
+                }
+                // Vulkan wants a 2D pointer array for the range infos.
+                rangeInfoPointers[meshIndex] = rangeInfos[meshIndex].data();
+
+                VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo = {
+                    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+                    .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+                    .flags = buildFlags,
+                    .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+                    .geometryCount = static_cast<uint32_t>(geometries[meshIndex].size()),
+                    .pGeometries = geometries[meshIndex].data(),
                 };
-                rangeInfos[meshIndex][primitiveIndex] = {
-                    .primitiveCount = static_cast<uint32_t>(primitiveCounts[primitiveIndex]),
-                    .primitiveOffset = 0, // This offsets both vertexData and indexData, however, we already do that ourselves.
-                    .firstVertex = 0,
-                    .transformOffset = 0,
+
+                auto sizes = blas.getBuildSizes(primitiveCounts.data(), &buildGeometryInfo, asProperties);
+                blas.createResultBuffer(sizes);
+                blas.createStructure(sizes);
+                ctx.setDebugUtilsName(blas.handle, blas.mesh.name);
+
+                if (!scratchArena.fits(sizes.buildScratchSize)) {
+                    // Build the current group, and wait for it to finish with the scratch memory.
+                    buildGroup(meshIndex);
+                    VkMemoryBarrier scratchBarrier = {
+                        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                        .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                        .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
+                    };
+                    vkCmdPipelineBarrier(cmdBuffer,
+                                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0,
+                                         1, &scratchBarrier, 0, nullptr, 0, nullptr);
+                    scratchArena.reset();
+                }
+
+                buildGeometryInfo.dstAccelerationStructure = blas.handle;
+                buildGeometryInfo.scratchData.deviceAddress = scratchArena.allocate(sizes.buildScratchSize);
+
+                ctx.setCheckpoint(cmdBuffer, "Copying mesh buffers!");
+                blas.uploadMeshBuffers(uploadBatch, *staging);
+                VkMemoryBarrier memBarrier = {
+                    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                    .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                    .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
                 };
-            }
+                vkCmdPipelineBarrier(cmdBuffer,
+                                     VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0,
+                                     1, &memBarrier, 0, nullptr, 0, nullptr);
 
-            VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo = {
-                .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
-                .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
-                .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR,
-                .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
-                .geometryCount = static_cast<uint32_t>(geometries[meshIndex].size()),
-                .pGeometries = geometries[meshIndex].data(),
-            };
+                buildGeometryInfos[meshIndex] = buildGeometryInfo;
+                blases.emplace_back(std::move(blas));
+
+                batchDeviceSize += meshBufferSize + sizes.accelerationStructureSize;
+            }
 
-            auto sizes = blas.getBuildSizes(primitiveCounts.data(), &buildGeometryInfo, asProperties);
-            blas.createScratchBuffer(sizes);
-            blas.createResultBuffer(sizes);
-            blas.createStructure(sizes);
-            ctx.setDebugUtilsName(blas.handle, blas.mesh.name);
+            // Finally, build the last group of acceleration structures.
+            if (groupStart < nextMesh)
+                buildGroup(nextMesh);
 
-            buildGeometryInfo.dstAccelerationStructure = blas.handle;
-            buildGeometryInfo.scratchData.deviceAddress = blas.scratchBuffer.getDeviceAddress();
+            if (compact) {
+                // The compacted sizes can only be queried once the builds have finished.
+                VkMemoryBarrier buildBarrier = {
+                    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                    .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                    .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
+                };
+                vkCmdPipelineBarrier(cmdBuffer,
+                                     VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0,
+                                     1, &buildBarrier, 0, nullptr, 0, nullptr);
+
+                std::vector<VkAccelerationStructureKHR> handles;
+                for (size_t i = batchStart; i < nextMesh; ++i) {
+                    handles.push_back(blases[firstBlas + i].handle);
+                }
+                vkCmdResetQueryPool(cmdBuffer, queryPool, batchStart, static_cast<uint32_t>(handles.size()));
+                ctx.writeAccelerationStructuresProperties(cmdBuffer, handles, VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, queryPool, batchStart);
+            }
 
-            ctx.setCheckpoint(cmdBuffer, "Copying mesh buffers!");
-            blas.copyMeshBuffers(cmdBuffer);
-            VkMemoryBarrier memBarrier = {
+            // The next batch reuses the scratch memory, and the TLAS build and the shaders read the
+            // BLASes and mesh buffers. These are all recorded into later submits to the same queue,
+            // so this barrier is enough and the batch doesn't have to be waited on.
+            VkMemoryBarrier batchBarrier = {
                 .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
-                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-                .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
+                .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_SHADER_READ_BIT,
             };
             vkCmdPipelineBarrier(cmdBuffer,
-                                 VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0,
-                                 1, &memBarrier, 0, nullptr, 0, nullptr);
+                                 VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0,
+                                 1, &batchBarrier, 0, nullptr, 0, nullptr);
+        }
+        // The staging memory is reclaimed once the submit has completed.
+        buildToken = uploadBatch.submit();
+        scratchArena.reset();
 
-            buildGeometryInfos[meshIndex] = buildGeometryInfo;
-            blases.emplace_back(blas);
+        for (size_t i = batchStart; i < nextMesh; ++i) {
+            blases[firstBlas + i].createGeometryDescriptionBuffer();
         }
+        ++batchCount;
+    }
 
-        // Get the pointers for each vector of range infos. Vulkan wants a 2D pointer array.
-        rangeInfoPointers.resize(rangeInfos.size());
-        std::transform(rangeInfos.begin(),  rangeInfos.end(), rangeInfoPointers.begin(), [](std::vector<VkAccelerationStructureBuildRangeInfoKHR>& vec) {
-            return vec.data();
-        });
+    VkDeviceSize vertexMemory = 0, indexMemory = 0;
+    for (size_t i = firstBlas; i < blases.size(); ++i) {
+        vertexMemory += blases[i].vertexBuffer.getSize();
+        indexMemory += blases[i].indexBuffer.getSize();
+    }
+    fmt::print("Mesh buffers use {:.2f} MiB of vertices and {:.2f} MiB of indices.\n",
+               static_cast<double>(vertexMemory) / (1024.0 * 1024.0), static_cast<double>(indexMemory) / (1024.0 * 1024.0));
+    fmt::print("Built {} BLASes in {} batches and {} groups, with at most {:.2f} MiB of scratch memory in use.\n",
+               blases.size() - firstBlas, batchCount, groupCount, static_cast<double>(scratchArena.getPeakUsedSize()) / (1024.0 * 1024.0));
+
+    // The compacted sizes can only be read back once the builds have completed, which is
+    // checked by the following frames instead of waiting for it here.
+    if (compact)
+        pendingCompactions.push_back({ firstBlas, meshes.size(), queryPool, buildToken });
+}
 
-        // Finally, build all of the acceleration structures.
-        ctx.setCheckpoint(cmdBuffer, "Building BLASes!");
-        ctx.buildAccelerationStructures(cmdBuffer, static_cast<uint32_t>(buildGeometryInfos.size()), buildGeometryInfos.data(), rangeInfoPointers.data());
-    });
+bool dp::ModelManager::compactBlases() {
+    bool compacted = false;
+    while (!pendingCompactions.empty() && uploadBatch.isComplete(pendingCompactions.front().buildToken)) {
+        const auto pending = pendingCompactions.front();
+        pendingCompactions.pop_front();
+
+        // The build has completed, so the results are available without waiting.
+        const auto blasCount = static_cast<uint32_t>(pending.blasCount);
+        std::vector<VkDeviceSize> compactedSizes(blasCount);
+        auto result = vkGetQueryPoolResults(ctx.device, pending.queryPool, 0, blasCount,
+                                            compactedSizes.size() * sizeof(VkDeviceSize), compactedSizes.data(), sizeof(VkDeviceSize),
+                                            VK_QUERY_RESULT_64_BIT);
+        checkResult(ctx, result, "Failed to get compacted acceleration structure sizes");
+        vkDestroyQueryPool(ctx.device, pending.queryPool, nullptr);
+
+        VkCommandBuffer cmdBuffer = uploadBatch.getCommandBuffer();
+        ctx.setCheckpoint(cmdBuffer, "Compacting BLASes!");
+        VkDeviceSize totalSize = 0, totalCompactedSize = 0;
+        for (uint32_t i = 0; i < blasCount; ++i) {
+            auto& blas = blases[pending.firstBlas + i];
+            const auto original = blas.compact(cmdBuffer, compactedSizes[i]);
+            const auto size = original.resultBuffer.getSize();
+            fmt::print("Compacted BLAS {}: {:.2f} KiB -> {:.2f} KiB\n", blas.mesh.name,
+                       static_cast<double>(size) / 1024.0, static_cast<double>(compactedSizes[i]) / 1024.0);
+            totalSize += size;
+            totalCompactedSize += compactedSizes[i];
+            // The copy and the frames in flight still read the original.
+            retire(original);
+        }
+        fmt::print("Compacted {} BLASes from {:.2f} MiB to {:.2f} MiB.\n", blasCount,
+                   static_cast<double>(totalSize) / (1024.0 * 1024.0), static_cast<double>(totalCompactedSize) / (1024.0 * 1024.0));
+        compacted = true;
+    }
 
-    for (auto& blas : blases) {
-        blas.destroyMeshBuffers();
-        blas.scratchBuffer.destroy();
+    if (compacted) {
+        // The TLAS build of this frame reads the compacted copies, and is submitted after the upload batch.
+        VkMemoryBarrier copyBarrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+            .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
+        };
+        vkCmdPipelineBarrier(uploadBatch.getCommandBuffer(),
+                             VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                             VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0,
+                             1, &copyBarrier, 0, nullptr, 0, nullptr);
     }
+    return compacted;
 }
 
 void dp::ModelManager::buildTlas() {
@@ -189,224 +372,433 @@ void dp::ModelManager::buildTlas() {
     };
     vkGetPhysicalDeviceProperties2(ctx.physicalDevice, &deviceProperties);
 
-    const uint32_t primitiveCount = std::min(static_cast<uint32_t>(blases.size()), static_cast<uint32_t>(asProperties.maxInstanceCount));
-
-    std::vector<VkAccelerationStructureInstanceKHR> instances(primitiveCount, VkAccelerationStructureInstanceKHR {});
-    for (auto& instance : instances) {
-        size_t index = &instance - &instances[0];
-        instance.transform = {
-            1.0, 0.0, 0.0, 0.0,
-            0.0, 1.0, 0.0, 0.0,
-            0.0, 0.0, 1.0, 0.0
-        };
-        instance.instanceCustomIndex = index;
+    // Every instance references the BLAS of its mesh. The custom index is used by the shaders to
+    // find the instance description, which describes the buffers of that BLAS. Instances whose
+    // mesh has not been streamed in yet are left out.
+    std::vector<VkAccelerationStructureInstanceKHR> instances;
+    instances.reserve(meshInstances.size());
+    tlasInstanceSources.clear();
+    tlasBuildBounds.clear();
+    for (const auto& meshInstance : meshInstances) {
+        if (meshInstance.meshIndex >= blases.size())
+            continue;
+        if (instances.size() >= asProperties.maxInstanceCount)
+            break;
+
+        auto& instance = instances.emplace_back();
+        instance.transform = meshInstance.transform;
+        instance.instanceCustomIndex = meshInstance.meshIndex;
         instance.mask = 0xFF;
         instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
         instance.instanceShaderBindingTableRecordOffset = 0;
-        instance.accelerationStructureReference = blases[index].address;
-    }
-
-    dp::StagingBuffer instanceStagingBuffer(ctx, "tlasInstanceStagingBuffer");
-    dp::Buffer instanceBuffer(ctx, "tlasInstanceBuffer");
-    VkDeviceAddress instanceDataDeviceAddress = {};
-
-    if (primitiveCount > 0) {
-        size_t instanceBufferSize = sizeof(VkAccelerationStructureInstanceKHR) * primitiveCount;
-        instanceStagingBuffer.create(instanceBufferSize);
-        instanceStagingBuffer.memoryCopy(instances.data(), instanceBufferSize);
+        instance.accelerationStructureReference = blases[meshInstance.meshIndex].address;
 
-        instanceBuffer.create(instanceBufferSize,
-                              VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-                              VMA_MEMORY_USAGE_GPU_ONLY);
-        instanceDataDeviceAddress = instanceBuffer.getDeviceAddress();
+        tlasInstanceSources.push_back(static_cast<uint32_t>(&meshInstance - &meshInstances[0]));
+        tlasBuildBounds.push_back(getInstanceBounds(meshInstance));
     }
+    const auto primitiveCount = static_cast<uint32_t>(instances.size());
+
+    // The instance buffer is only recreated when it has to grow. It is read directly from host
+    // visible memory, so that updateTlas() can write new transforms without a staging copy.
+    const VkDeviceSize instanceBufferSize = sizeof(VkAccelerationStructureInstanceKHR) * std::max(primitiveCount, 1U) * ctx.framesInFlight;
+    if (mappedTlasInstances == nullptr || tlasInstanceBuffer.getSize() < instanceBufferSize) {
+        if (mappedTlasInstances != nullptr)
+            tlasInstanceBuffer.unmapMemory();
+        retire(tlasInstanceBuffer);
+        tlasInstanceBuffer.create(instanceBufferSize,
+                                  VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                                  VMA_MEMORY_USAGE_CPU_TO_GPU,
+                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        tlasInstanceBuffer.mapMemory(reinterpret_cast<void**>(&mappedTlasInstances));
+    }
+    tlasInstances = std::move(instances);
 
-    VkAccelerationStructureGeometryKHR accelerationStructureGeometry = {
+    tlasGeometry = {
         .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
         .geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR,
         .geometry = {
             .instances = {
                 .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
                 .arrayOfPointers = VK_FALSE,
-                .data = {
-                    .deviceAddress = instanceDataDeviceAddress,
-                },
             },
         },
     };
 
-    VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo = {
-        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
-        .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
-        .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR,
-        .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
-        .geometryCount = 1, // Has to be exactly one for a TLAS
-        .pGeometries = &accelerationStructureGeometry,
-    };
+    auto buildGeometryInfo = getTlasBuildInfo(VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR);
     auto sizes = tlas.getBuildSizes(&primitiveCount, &buildGeometryInfo, asProperties);
+    // The scratch buffer is kept for refits, which might need a different amount of scratch memory.
+    sizes.buildScratchSize = std::max(sizes.buildScratchSize,
+                                      dp::Buffer::alignedSize(sizes.updateScratchSize, asProperties.minAccelerationStructureScratchOffsetAlignment));
+    // The frames in flight might still trace against the previous TLAS.
+    retire(tlas);
     tlas.createScratchBuffer(sizes);
     tlas.createResultBuffer(sizes);
     tlas.createStructure(sizes);
     ctx.setDebugUtilsName(tlas.handle, "TLAS");
 
-    // Update buildGeometryInfo
+    // The build is recorded into the next frame's commands, instead of waiting on a submit of its own.
+    pendingTlasUpdate = true;
+    pendingTlasRebuild = true;
+}
+
+void dp::ModelManager::updateTlas(const std::vector<VkTransformMatrixKHR>& transforms) {
+    if (transforms.size() != meshInstances.size()) {
+        fmt::print(stderr, "Got {} transforms for {} instances, the TLAS is not updated.\n", transforms.size(), meshInstances.size());
+        return;
+    }
+    for (size_t i = 0; i < transforms.size(); ++i) {
+        meshInstances[i].transform = transforms[i];
+    }
+    if (tlasInstanceSources.empty())
+        return;
+
+    // A refit keeps the tree of the last full build, whose nodes grow as their instances move
+    // apart. We estimate this through the bounds spanning the built and current position of each
+    // instance, and rebuild the tree once these have grown too large.
+    auto surfaceArea = [](const InstanceBounds& bounds) {
+        const glm::vec3 size = glm::max(bounds.max - bounds.min, glm::vec3(0.0f));
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    };
+    std::vector<InstanceBounds> currentBounds(tlasInstanceSources.size());
+    float spannedArea = 0.0f, currentArea = 0.0f;
+    for (size_t i = 0; i < tlasInstanceSources.size(); ++i) {
+        const auto& meshInstance = meshInstances[tlasInstanceSources[i]];
+        tlasInstances[i].transform = meshInstance.transform;
+
+        currentBounds[i] = getInstanceBounds(meshInstance);
+        spannedArea += surfaceArea({
+            glm::min(currentBounds[i].min, tlasBuildBounds[i].min),
+            glm::max(currentBounds[i].max, tlasBuildBounds[i].max),
+        });
+        currentArea += surfaceArea(currentBounds[i]);
+    }
+
+    pendingTlasUpdate = true;
+    if (currentArea > 0.0f && spannedArea / currentArea > tlasRebuildThreshold) {
+        pendingTlasRebuild = true;
+        tlasBuildBounds = std::move(currentBounds);
+    }
+}
+
+void dp::ModelManager::writeTlasInstances() {
+    // Each frame has its own part of the buffer. The current frame's fence has been waited on,
+    // so no build is reading its part anymore.
+    const VkDeviceSize frameOffset = (tlasInstanceBuffer.getSize() / ctx.framesInFlight) * ctx.currentFrame;
+    if (!tlasInstances.empty())
+        memcpy(mappedTlasInstances + frameOffset, tlasInstances.data(), sizeof(VkAccelerationStructureInstanceKHR) * tlasInstances.size());
+    tlasGeometry.geometry.instances.data.deviceAddress = tlasInstanceBuffer.getDeviceAddress() + frameOffset;
+}
+
+void dp::ModelManager::recordTlasUpdate(VkCommandBuffer cmdBuffer) {
+    if (!pendingTlasUpdate)
+        return;
+
+    writeTlasInstances();
+
+    // A rebuild either builds a newly created TLAS, or rebuilds the current one in place, as the
+    // instance count did not change.
+    auto buildGeometryInfo = getTlasBuildInfo(pendingTlasRebuild ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR);
+    buildGeometryInfo.srcAccelerationStructure = pendingTlasRebuild ? nullptr : tlas.handle;
     buildGeometryInfo.dstAccelerationStructure = tlas.handle;
     buildGeometryInfo.scratchData.deviceAddress = tlas.scratchBuffer.getDeviceAddress();
 
     VkAccelerationStructureBuildRangeInfoKHR buildRangeInfo = {
-        .primitiveCount = primitiveCount,
-        .primitiveOffset = 0,
-        .firstVertex = 0,
-        .transformOffset = 0,
+        .primitiveCount = static_cast<uint32_t>(tlasInstanceSources.size()),
+    };
+    VkAccelerationStructureBuildRangeInfoKHR* buildRangeInfos[] = { &buildRangeInfo };
+
+    // The instances have been written by the host before the submit. The TLAS is updated in
+    // place, so the build has to wait for the frames in flight still tracing against it.
+    VkMemoryBarrier traceBarrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
+        .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+    };
+    vkCmdPipelineBarrier(cmdBuffer,
+                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0,
+                         1, &traceBarrier, 0, nullptr, 0, nullptr);
+
+    ctx.setCheckpoint(cmdBuffer, pendingTlasRebuild ? "Rebuilding TLAS!" : "Refitting TLAS!");
+    ctx.buildAccelerationStructures(cmdBuffer, 1, &buildGeometryInfo, buildRangeInfos);
+    VkMemoryBarrier memBarrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+        .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
     };
-    std::vector<VkAccelerationStructureBuildRangeInfoKHR*> buildRangeInfos = { &buildRangeInfo };
+    vkCmdPipelineBarrier(cmdBuffer,
+                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0,
+                         1, &memBarrier, 0, nullptr, 0, nullptr);
 
-    ctx.oneTimeSubmit(ctx.graphicsQueue, ctx.commandPool, [&](auto cmdBuffer) {
-        instanceStagingBuffer.copyToBuffer(cmdBuffer, instanceBuffer);
-        VkMemoryBarrier memBarrier = {
-            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
-            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-            .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
-        };
-        vkCmdPipelineBarrier(cmdBuffer,
-                             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0,
-                             1, &memBarrier, 0, nullptr, 0, nullptr);
-        ctx.setCheckpoint(cmdBuffer, "Building TLAS!");
-        ctx.buildAccelerationStructures(cmdBuffer, 1, &buildGeometryInfo, buildRangeInfos.data());
-    });
-
-    tlas.scratchBuffer.destroy();
-    instanceStagingBuffer.destroy();
-    instanceBuffer.destroy();
+    pendingTlasUpdate = false;
+    pendingTlasRebuild = false;
 }
 
-void dp::ModelManager::destroy() {
-    materialBuffer.destroy();
-    instanceDescriptionBuffer.destroy();
+auto dp::ModelManager::getInstanceBounds(const dp::MeshInstance& instance) const -> InstanceBounds {
+    // Transforms the bounds of the BLAS as a center and extent, which is exact for affine transforms.
+    const auto& blas = blases[instance.meshIndex];
+    const glm::vec3 center = (blas.minBounds + blas.maxBounds) * 0.5f;
+    const glm::vec3 extent = (blas.maxBounds - blas.minBounds) * 0.5f;
+
+    InstanceBounds bounds = {};
+    for (glm::length_t row = 0; row < 3; ++row) {
+        const float* m = instance.transform.matrix[row];
+        const float transformedCenter = m[0] * center.x + m[1] * center.y + m[2] * center.z + m[3];
+        const float transformedExtent = std::abs(m[0]) * extent.x + std::abs(m[1]) * extent.y + std::abs(m[2]) * extent.z;
+        bounds.min[row] = transformedCenter - transformedExtent;
+        bounds.max[row] = transformedCenter + transformedExtent;
+    }
+    return bounds;
+}
+
+auto dp::ModelManager::getTlasBuildInfo(VkBuildAccelerationStructureModeKHR mode) const -> VkAccelerationStructureBuildGeometryInfoKHR {
+    return {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+        .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR,
+        .mode = mode,
+        .geometryCount = 1, // Has to be exactly one for a TLAS
+        .pGeometries = &tlasGeometry,
+    };
+}
+
+void dp::ModelManager::clearScene() {
+    // Compactions still pending refer to the BLASes of this scene.
+    for (const auto& pending : pendingCompactions) {
+        vkDestroyQueryPool(ctx.device, pending.queryPool, nullptr);
+    }
+    pendingCompactions.clear();
+
     for (auto& blas : blases) {
         blas.vertexBuffer.destroy();
         blas.indexBuffer.destroy();
-        blas.transformBuffer.destroy();
+        blas.geometryDescriptionBuffer.destroy();
         blas.destroy();
     }
-    for (auto& texture : textures) {
-        texture.destroy();
+    blases.clear();
+    meshInstances.clear();
+
+    // The textures are only released, so that they can be reused by the next scene.
+    for (auto slot : sceneTextureSlots) {
+        textureRegistry.release(slot);
     }
-    tlas.destroy();
+    sceneTextureSlots.clear();
 }
 
-void dp::ModelManager::init() {
-    // Empty texture file as we always need at least 1 texture to exist.
-    dp::TextureFile emptyTextureFile;
-    emptyTextureFile.width = 1; emptyTextureFile.height = 1;
-    emptyTextureFile.pixels = { 0xFF, 0xFF, 0xFF, 0xFF }; // White image
-    emptyTextureFile.format = VK_FORMAT_R8G8B8A8_SRGB;
-    uploadTexture(emptyTextureFile);
-
-    // Build the basic TLAS with no BLASes.
+void dp::ModelManager::publishScene() {
     buildTlas();
+    engine.updateTlas();
+    pendingScenePublish = false;
+    lastScenePublish = std::chrono::steady_clock::now();
 }
 
-std::vector<VkDescriptorImageInfo> dp::ModelManager::getTextureDescriptorInfos() {
-    // Create the image infos for each texture
-    std::vector<VkDescriptorImageInfo> descriptors(textures.size());
-    for (size_t i = 0; i < descriptors.size(); i++) {
-        descriptors[i].sampler = textures[i].getSampler();
-        descriptors[i].imageLayout = textures[i].getImageLayout();
-        descriptors[i].imageView = VkImageView(textures[i]);
-    }
-    return descriptors;
+auto dp::ModelManager::getRetiredResources() -> RetiredResources& {
+    // Everything retired during the same frame is destroyed together.
+    if (retiredResources.empty() || retiredResources.back().remainingFrames != ctx.framesInFlight)
+        retiredResources.push_back({ .remainingFrames = ctx.framesInFlight });
+    return retiredResources.back();
 }
 
-void dp::ModelManager::loadScene(const std::string& path) {
-    auto loader = [&](const std::string& path) -> void {
-        fileLoader.loadFile(fs::path(path));
-        sceneLoadFinished = true;
-    };
+void dp::ModelManager::retire(const dp::Buffer& buffer) {
+    if (buffer.getHandle() != nullptr)
+        getRetiredResources().buffers.push_back(buffer);
+}
 
-    std::thread t(loader, path);
-    fileLoadThread = std::move(t);
+void dp::ModelManager::retire(const dp::AccelerationStructure& accelerationStructure) {
+    if (accelerationStructure.handle != nullptr)
+        getRetiredResources().accelerationStructures.push_back(accelerationStructure);
 }
 
-void dp::ModelManager::renderTick() {
-    if (sceneLoadFinished) {
-        sceneLoadFinished = false;
-        fileLoadThread.detach();
-
-        // Delete old textures and BLASs and the TLAS.
-        // We do not want to delete the first image, as that has to always exist.
-        for (uint64_t i = 1; i < textures.size(); i++) {
-            textures[i].destroy();
-        }
-        textures.erase(textures.begin() + 1, textures.end()); // Leaves all but the first.
-        for (auto& blas : blases) {
-            blas.destroy();
-        }
-        blases.clear();
-        tlas.destroy();
+void dp::ModelManager::retire(const dp::Texture& texture) {
+    getRetiredResources().textures.push_back(texture);
+}
 
-        // Build new BLASes
-        buildBlases();
+void dp::ModelManager::destroyRetiredResources(bool allFramesComplete) {
+    if (!allFramesComplete) {
+        for (auto& resources : retiredResources) {
+            --resources.remainingFrames;
+        }
+    }
 
-        // Upload new textures
-        for (auto& file : fileLoader.textures) {
-            uploadTexture(file);
+    while (!retiredResources.empty() && (allFramesComplete || retiredResources.front().remainingFrames == 0)) {
+        auto& resources = retiredResources.front();
+        for (auto& buffer : resources.buffers) {
+            buffer.destroy();
+        }
+        for (auto& accelerationStructure : resources.accelerationStructures) {
+            accelerationStructure.destroy();
         }
+        for (auto& texture : resources.textures) {
+            texture.destroy();
+        }
+        retiredResources.pop_front();
+    }
+}
 
-        buildTlas();
-        engine.updateTlas();
+void dp::ModelManager::destroy() {
+    if (fileLoadThread.joinable())
+        fileLoadThread.join();
 
-        engine.ui.reloadingScene = false;
-    }
+    ctx.waitForAllFrames();
+    destroyRetiredResources(true);
+    materialBuffer.destroy();
+    instanceDescriptionBuffer.destroy();
+    // Waits for the uploads in flight, before their textures and buffers are destroyed.
+    uploadBatch.destroy();
+    clearScene();
+    textureRegistry.destroy();
+    scratchArena.destroy();
+    if (mappedTlasInstances != nullptr)
+        tlasInstanceBuffer.unmapMemory();
+    tlasInstanceBuffer.destroy();
+    tlas.destroy();
 }
 
-void dp::ModelManager::uploadTexture(dp::TextureFile& textureFile) {
-    if (textureFile.pixels.empty()) {
-        fmt::print("Empty texture! {}\n", textureFile.filePath.string());
-        return;
-    }
+void dp::ModelManager::init() {
+    VkPhysicalDeviceProperties2 deviceProperties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &this->asProperties,
+    };
+    vkGetPhysicalDeviceProperties2(ctx.physicalDevice, &deviceProperties);
+    scratchArena.init(asProperties.minAccelerationStructureScratchOffsetAlignment);
 
-    dp::StagingBuffer stagingBuffer(ctx, "textureStagingBuffer");
-    stagingBuffer.create(textureFile.pixels.size());
-    stagingBuffer.memoryCopy(textureFile.pixels.data(), textureFile.pixels.size());
+    // Creates the default texture, as we always need at least 1 texture to exist.
+    uploadBatch.create(stagingSize);
+    textureRegistry.init();
+    uploadBatch.submit();
 
-    // Generating mip levels requires blit support
-    uint32_t mipLevels = 1;
-    if (dp::Texture::formatSupportsBlit(ctx, textureFile.format)) {
-        mipLevels = textureFile.mipLevels;
-    }
+    // Create the basic TLAS with no BLASes, which is built with the first frame.
+    buildTlas();
+}
+
+std::vector<VkDescriptorImageInfo> dp::ModelManager::getTextureDescriptorInfos() {
+    return textureRegistry.getDescriptorInfos();
+}
 
-    dp::Texture texture(ctx, { textureFile.width, textureFile.height }, textureFile.filePath.filename().string());
-    texture.createTexture(textureFile.format, mipLevels);
-
-    ctx.oneTimeSubmit(ctx.graphicsQueue, ctx.commandPool, [&](VkCommandBuffer cmdBuffer) {
-        // Copy the staging buffer into the image.
-        texture.changeLayout(
-            cmdBuffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 },
-            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
-        VkBufferImageCopy copy = {
-            .bufferOffset = 0,
-            .bufferRowLength = 0,
-            .bufferImageHeight = 0,
-            .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
-            .imageExtent = texture.getImageSize3d(),
+void dp::ModelManager::loadScene(const std::string& path) {
+    // The previous thread has always finished pushing its scene, as the UI only allows
+    // loading another scene once the current one has been fully streamed in.
+    if (fileLoadThread.joinable())
+        fileLoadThread.join();
+
+    fileLoadThread = std::thread([this](const std::string& path) {
+        // The meshes go first, as they are required for anything to appear on screen. They are
+        // pushed as soon as they have been parsed, and each texture once it has been decoded.
+        fileLoader.onGeometryLoaded = [this](dp::FileLoader& loader) {
+            sceneStream.push(SceneLayout {
+                .materials = std::move(loader.materials),
+                .instances = std::move(loader.instances),
+                .meshCount = loader.meshes.size(),
+                .textureCount = loader.textures.size(),
+            });
+            for (auto& mesh : loader.meshes) {
+                sceneStream.push(std::move(mesh));
+            }
+            loader.meshes.clear();
         };
-        stagingBuffer.copyToImage(cmdBuffer, texture, texture.getImageLayout(), &copy);
-
-        if (mipLevels == 1) {
-            texture.changeLayout(
-                cmdBuffer, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 },
-                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
-        } else {
-            // Generate mipmaps. Generating mipmaps will automatically transition to SHADER_READ_ONLY_OPTIMAL
-            texture.generateMipmaps(cmdBuffer);
+        fileLoader.onTextureLoaded = [this](dp::TextureFile& texture) {
+            sceneStream.push(std::move(texture));
+        };
+
+        // A scene that failed to load is streamed as an empty scene.
+        if (!fileLoader.loadFile(fs::path(path)))
+            sceneStream.push(SceneLayout {});
+        fileLoader.textures.clear();
+    }, path);
+}
+
+void dp::ModelManager::renderTick() {
+    destroyRetiredResources(false);
+
+    bool sceneChanged = false, layoutChanged = false;
+    std::vector<dp::Mesh> newMeshes;
+    size_t streamedTriangles = 0, streamedTextureBytes = 0;
+
+    // Only handle a bounded amount of the streamed scene each frame, so that the frame rate
+    // stays steady while a large scene is loading.
+    while (streamedTriangles < streamTriangleBudget && streamedTextureBytes < streamTextureBudget) {
+        auto item = sceneStream.tryPop();
+        if (!item.has_value())
+            break;
+
+        if (auto* layout = std::get_if<SceneLayout>(&*item)) {
+            // Meshes of a previous scene that were not built yet are discarded. The frames in
+            // flight might still be tracing against the previous scene.
+            newMeshes.clear();
+            ctx.waitForAllFrames();
+            uploadBatch.wait(uploadBatch.submit());
+            destroyRetiredResources(true);
+            clearScene();
+
+            sceneMaterials = std::move(layout->materials);
+            meshInstances = std::move(layout->instances);
+            sceneTextureSlots.assign(layout->textureCount, dp::TextureRegistry::defaultSlot);
+            expectedMeshCount = layout->meshCount;
+            receivedTextureCount = 0;
+            streamingScene = true;
+            streamStart = std::chrono::steady_clock::now();
+            uploadBatch.resetStatistics();
+            sceneChanged = true;
+            layoutChanged = true;
+        } else if (auto* mesh = std::get_if<dp::Mesh>(&*item)) {
+            for (const auto& primitive : mesh->primitives) {
+                streamedTriangles += primitive.indices.size() / 3;
+            }
+            newMeshes.push_back(std::move(*mesh));
+        } else if (auto* texture = std::get_if<dp::TextureFile>(&*item)) {
+            streamedTextureBytes += texture->pixels.size();
+            sceneTextureSlots[receivedTextureCount++] = textureRegistry.acquire(*texture);
+            sceneChanged = true;
         }
-    });
-    stagingBuffer.destroy();
+    }
+
+    // Compacting replaces the BLASes, so the TLAS has to be republished with their new addresses
+    // right away, before the retired originals are destroyed.
+    const bool compacted = compactBlases();
+    sceneChanged |= compacted;
+
+    // The meshes are submitted together with the textures and compactions of this frame, which are
+    // otherwise uploaded with a single submit of their own.
+    if (!newMeshes.empty()) {
+        buildBlases(newMeshes);
+        sceneChanged = true;
+    }
+    uploadBatch.submit();
+
+    // Republish the TLAS with everything that has been streamed in so far. As every publish builds the
+    // TLAS over all instances, this is only done every scenePublishInterval while the scene is streamed
+    // in. A new layout is published right away, as the previous TLAS references the destroyed BLASes.
+    pendingScenePublish |= sceneChanged;
+    const bool streamFinished = streamingScene && blases.size() == expectedMeshCount && receivedTextureCount == sceneTextureSlots.size();
+    if (pendingScenePublish &&
+        (layoutChanged || compacted || streamFinished || !streamingScene || std::chrono::steady_clock::now() - lastScenePublish >= scenePublishInterval)) {
+        publishScene();
+    }
 
-    textures.emplace_back(texture);
+    if (streamFinished) {
+        streamingScene = false;
+        fileLoadThread.join();
 
-    fmt::print("Finished uploading texture {}!\n", textureFile.filePath.string());
+        // The descriptor sets of the frames in flight might still point to the evicted textures, so
+        // they are retired and every set is pointed to the remaining textures when it is recorded next.
+        auto evictedTextures = textureRegistry.trim();
+        for (const auto& texture : evictedTextures) {
+            retire(texture);
+        }
+        if (!evictedTextures.empty())
+            engine.updateTlas();
+
+        std::chrono::duration<double, std::milli> streamTime = std::chrono::steady_clock::now() - streamStart;
+        fmt::print("Streamed in {} BLASes for {} instances and {} textures in {:.2f}ms\n",
+                   blases.size(), meshInstances.size(), receivedTextureCount, streamTime.count());
+        fmt::print("Peak scratch memory use was {:.2f} MiB, from {} blocks with {:.2f} MiB in total.\n",
+                   static_cast<double>(scratchArena.getPeakUsedSize()) / (1024.0 * 1024.0), scratchArena.getBlockCount(),
+                   static_cast<double>(scratchArena.getAllocatedSize()) / (1024.0 * 1024.0));
+        const auto& uploads = uploadBatch.getStatistics();
+        fmt::print("Staged {} uploads with {:.2f} MiB in total, which needed {} staging buffer allocations.\n",
+                   uploads.uploadCount, static_cast<double>(uploads.uploadedSize) / (1024.0 * 1024.0), uploads.allocationCount);
+        // The scratch memory is only needed again once the next scene is loaded.
+        uploadBatch.wait(uploadBatch.submit());
+        scratchArena.destroy();
+        engine.ui.reloadingScene = false;
+    }
 }
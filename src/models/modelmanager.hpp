@@ -1,32 +1,137 @@
 #pragma once
 
-#include <future>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <variant>
 
+#include "../utils/spsc_queue.hpp"
+#include "../vulkan/resource/uploadbatch.hpp"
 #include "../vulkan/rt/acceleration_structure.hpp"
+#include "../vulkan/rt/scratch_arena.hpp"
 #include "fileloader.hpp"
 #include "mesh.hpp"
+#include "textureregistry.hpp"
 
 namespace dp {
     class Engine;
 
     class ModelManager {
+        /**
+         * The first item streamed for each scene, describing everything but the meshes and
+         * textures, which are streamed afterwards in order of their indices.
+         */
+        struct SceneLayout {
+            std::vector<dp::Material> materials;
+            std::vector<dp::MeshInstance> instances;
+            size_t meshCount = 0;
+            size_t textureCount = 0;
+        };
+        using SceneStreamItem = std::variant<SceneLayout, dp::Mesh, dp::TextureFile>;
+
+        struct InstanceBounds {
+            glm::vec3 min;
+            glm::vec3 max;
+        };
+
+        /** Resources that have been replaced, but might still be used by the frames in flight. */
+        struct RetiredResources {
+            /** The amount of frames that still have to begin before these can be destroyed. */
+            uint32_t remainingFrames = 0;
+            std::vector<dp::Buffer> buffers;
+            std::vector<dp::AccelerationStructure> accelerationStructures;
+            std::vector<dp::Texture> textures;
+        };
+
+        /** BLASes whose compacted sizes are queried by a build that might not have completed yet. */
+        struct PendingCompaction {
+            size_t firstBlas = 0;
+            size_t blasCount = 0;
+            VkQueryPool queryPool = nullptr;
+            dp::UploadToken buildToken = 0;
+        };
+
         const dp::Context& ctx;
         dp::Engine& engine;
 
+        /** Only ever used by the fileLoadThread, which pushes the loaded scene into the sceneStream. */
         dp::FileLoader fileLoader;
-        std::atomic<bool> sceneLoadFinished = false;
         std::thread fileLoadThread;
+        dp::SpscQueue<SceneStreamItem> sceneStream;
+
+        /** Whether the current scene is still being streamed in. */
+        bool streamingScene = false;
+        size_t expectedMeshCount = 0;
+        size_t receivedTextureCount = 0;
+        std::chrono::steady_clock::time_point streamStart;
 
-        std::vector<dp::Texture> textures;
+        std::vector<dp::Material> sceneMaterials;
+        /** Records the texture and mesh uploads, and is declared first as the texture registry records into it. */
+        dp::UploadBatch uploadBatch;
+        dp::TextureRegistry textureRegistry;
+        /** The registry slot of each texture of the current scene, indexed like the scene's textures. */
+        std::vector<uint32_t> sceneTextureSlots;
 
         VkPhysicalDeviceAccelerationStructurePropertiesKHR asProperties = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR, };
 
-        void uploadTexture(dp::TextureFile& textureFile);
+        /** The instances of the TLAS. The buffer stays mapped, so that transforms can be updated without a staging copy. */
+        std::vector<VkAccelerationStructureInstanceKHR> tlasInstances;
+        /** Holds a copy of the instances for each frame in flight, as a build might still read the previous frame's copy. */
+        dp::Buffer tlasInstanceBuffer;
+        uint8_t* mappedTlasInstances = nullptr;
+        /** The index into meshInstances of each instance of the TLAS. */
+        std::vector<uint32_t> tlasInstanceSources;
+        /** The world space bounds of each instance of the TLAS at its last full build. */
+        std::vector<InstanceBounds> tlasBuildBounds;
+        VkAccelerationStructureGeometryKHR tlasGeometry = {};
+        bool pendingTlasUpdate = false;
+        bool pendingTlasRebuild = false;
+        /** Whether the streamed in scene has changed since the TLAS was last republished. */
+        bool pendingScenePublish = false;
+        std::chrono::steady_clock::time_point lastScenePublish;
+        std::deque<RetiredResources> retiredResources;
+        /** The BLAS builds waiting to be compacted, in the order they were submitted. */
+        std::deque<PendingCompaction> pendingCompactions;
+
+        [[nodiscard]] auto getInstanceBounds(const dp::MeshInstance& instance) const -> InstanceBounds;
+        [[nodiscard]] auto getTlasBuildInfo(VkBuildAccelerationStructureModeKHR mode) const -> VkAccelerationStructureBuildGeometryInfoKHR;
+        /** Copies the instances into the current frame's part of the instance buffer, and points the TLAS geometry to it. */
+        void writeTlasInstances();
+
+        /**
+         * Replaces the BLASes of every pending compaction whose build has completed with compacted copies,
+         * which are recorded into the upload batch. The originals are retired, and the memory saved for
+         * each mesh is printed. Returns whether any BLAS has been replaced, which changes its address.
+         */
+        bool compactBlases();
+        /** Destroys all BLASes and their buffers, and releases the textures of the current scene. */
+        void clearScene();
+        /** Rebuilds the TLAS over everything streamed in so far, and points the engine's descriptors to it. */
+        void publishScene();
+
+        /**
+         * Keeps given resource alive until the frames in flight are done with it. The caller has to
+         * create a new one in its place right away, as the handles are not reset.
+         */
+        void retire(const dp::Buffer& buffer);
+        void retire(const dp::AccelerationStructure& accelerationStructure);
+        void retire(const dp::Texture& texture);
+        /** Gets the resources retired during the current frame. */
+        auto getRetiredResources() -> RetiredResources&;
+        /**
+         * Has to be called once per frame, after the frame's fence has been waited on. Destroys the retired
+         * resources the frames in flight can't use anymore, or all of them once all frames have been waited on.
+         */
+        void destroyRetiredResources(bool allFramesComplete);
 
     public:
         std::vector<dp::InstanceDescription> instanceDescriptions;
+        /** The instances of the current scene, each referencing a BLAS through its mesh index. */
+        std::vector<dp::MeshInstance> meshInstances;
         std::vector<dp::BottomLevelAccelerationStructure> blases;
         dp::TopLevelAccelerationStructure tlas;
+        /** The scratch memory for BLAS builds. Its budget limits how much scratch memory the builds use at once. */
+        dp::ScratchArena scratchArena;
 
         /** A buffer of all materials. */
         dp::Buffer materialBuffer;
@@ -34,17 +139,50 @@ namespace dp {
         /** A buffer containing instanceDescriptions of BLASes */
         dp::Buffer instanceDescriptionBuffer;
 
+        /** The amount of triangles built into BLASes per frame while a scene is streamed in. */
+        size_t streamTriangleBudget = 1'000'000;
+        /** The amount of texture memory uploaded per frame while a scene is streamed in. */
+        size_t streamTextureBudget = 32 * 1024 * 1024;
+        /** How often the TLAS is republished while a scene is streamed in, as every publish builds it over all instances. */
+        std::chrono::milliseconds scenePublishInterval = std::chrono::milliseconds(250);
+        /** The fraction of the available device memory each batch of BLAS builds may use. */
+        double buildMemoryFraction = 0.5;
+        /** The size of the staging ring all uploads go through. Has to be set before init(). */
+        VkDeviceSize stagingSize = 64 * 1024 * 1024;
+        /**
+         * How far refits may degrade the TLAS before it is rebuilt instead. This is the ratio of the surface
+         * area of the bounds spanning both the built and the current position of each instance, to the
+         * surface area of the current bounds alone.
+         */
+        float tlasRebuildThreshold = 1.5f;
+
         explicit ModelManager(const dp::Context& context, dp::Engine& engine);
 
         void createDescriptionBuffers();
-        void buildBlases();
-        /** Builds, or rebuilds the TLAS. Will invalid the handle, so call dp::Engine::updateTlas() right after. */
+        /** Builds a BLAS for each of given meshes, appending them to blases. The meshes are moved from. */
+        void buildBlases(std::vector<dp::Mesh>& meshes);
+        /**
+         * Creates a new TLAS over all instances whose mesh has been built, which is built by the next call to
+         * recordTlasUpdate. The previous TLAS is retired. Will invalid the handle, so call dp::Engine::updateTlas() right after.
+         */
         void buildTlas();
+        /**
+         * Sets new transforms for the instances, indexed like meshInstances, and schedules a refit of
+         * the TLAS, which keeps its handle. Has to be called before the frame's commands are recorded.
+         */
+        void updateTlas(const std::vector<VkTransformMatrixKHR>& transforms);
+        /** Records the build scheduled by buildTlas(), or the refit or rebuild scheduled by updateTlas(). Has to be recorded before tracing rays. */
+        void recordTlasUpdate(VkCommandBuffer cmdBuffer);
         void destroy();
         /** First init call, creating a basic TLAS and a basic empty image. */
         void init();
         auto getTextureDescriptorInfos() -> std::vector<VkDescriptorImageInfo>;
+        /** Starts loading given scene on a separate thread, which streams it into the sceneStream. */
         void loadScene(const std::string& path);
+        /**
+         * Builds and uploads a bounded amount of the streamed scene, and republishes the TLAS at most every
+         * scenePublishInterval. Has to be called once per frame, after the frame's fence has been waited on.
+         */
         void renderTick();
     };
 }
@@ -0,0 +1,187 @@
+#include "scenecache.hpp"
+
+#include <algorithm>
+
+#include <fmt/core.h>
+
+#include "fileloader.hpp"
+#include "../utils/binary_file.hpp"
+#include "../utils/hash.hpp"
+#include "../utils/mapped_file.hpp"
+
+auto dp::SceneCache::getCachePath(const fs::path& sourcePath) -> fs::path {
+    auto cachePath = sourcePath;
+    cachePath += ".dpscene";
+    return cachePath;
+}
+
+auto dp::SceneCache::hashSource(const fs::path& sourcePath) -> uint64_t {
+    dp::MappedFile source;
+    if (!source.open(sourcePath))
+        return 0;
+    return dp::hashBytes(source.getData(), source.getSize());
+}
+
+auto dp::SceneCache::getDependencyStamp(const fs::path& path) -> DependencyStamp {
+    // A missing file gets the error values, which only match if it was already missing before.
+    std::error_code error;
+    return {
+        .size = static_cast<uint64_t>(fs::file_size(path, error)),
+        .writeTime = static_cast<int64_t>(fs::last_write_time(path, error).time_since_epoch().count()),
+    };
+}
+
+auto dp::SceneCache::getFlags(const dp::FileLoader& loader) -> uint32_t {
+    uint32_t flags = 0;
+    if (loader.optimizeMeshes)
+        flags |= OptimizedMeshes;
+    return flags;
+}
+
+bool dp::SceneCache::read(const fs::path& sourcePath, dp::FileLoader& loader) {
+    dp::MappedFile cacheFile;
+    if (!cacheFile.open(getCachePath(sourcePath)))
+        return false;
+
+    dp::BinaryReader reader(cacheFile.getData(), cacheFile.getSize());
+    Header header = {};
+    const Header expected = {};
+    if (!reader.read(header) || header.magic != expected.magic || header.version != expected.version
+        || header.vertexSize != expected.vertexSize || header.indexSize != expected.indexSize
+        || header.materialSize != expected.materialSize) {
+        fmt::print("Scene cache {} is outdated.\n", getCachePath(sourcePath).string());
+        return false;
+    }
+    if (header.flags != getFlags(loader)) {
+        fmt::print("Scene cache {} was written with different options.\n", getCachePath(sourcePath).string());
+        return false;
+    }
+    if (header.sourceHash != hashSource(sourcePath)) {
+        fmt::print("Scene cache {} does not match its source.\n", getCachePath(sourcePath).string());
+        return false;
+    }
+
+    std::vector<fs::path> dependencies;
+    for (uint64_t i = 0; i < header.dependencyCount; ++i) {
+        std::string path;
+        DependencyStamp stamp = {};
+        if (!reader.readString(path) || !reader.read(stamp.size) || !reader.read(stamp.writeTime)) {
+            fmt::print(stderr, "Scene cache {} is corrupted.\n", getCachePath(sourcePath).string());
+            return false;
+        }
+        auto& dependency = dependencies.emplace_back(std::u8string(path.begin(), path.end()));
+        auto currentStamp = getDependencyStamp(dependency);
+        if (currentStamp.size != stamp.size || currentStamp.writeTime != stamp.writeTime) {
+            fmt::print("Scene cache {} does not match {}.\n", getCachePath(sourcePath).string(), dependency.string());
+            return false;
+        }
+    }
+
+    // Everything is read into locals first, so that the loader is left untouched if the cache turns
+    // out to be corrupted, and the file is parsed instead. The counts are not trusted, so the vectors
+    // only grow with each element that has actually been read.
+    std::vector<dp::Material> materials;
+    std::vector<dp::Mesh> meshes;
+    std::vector<dp::MeshInstance> instances;
+    std::vector<dp::TextureFile> textures;
+
+    bool success = reader.readSizedArray(materials, arrayAlignment);
+    for (uint64_t i = 0; success && i < header.meshCount; ++i) {
+        auto& mesh = meshes.emplace_back();
+        uint64_t primitiveCount = 0;
+        success = reader.readString(mesh.name) && reader.read(primitiveCount);
+
+        for (uint64_t j = 0; success && j < primitiveCount; ++j) {
+            auto& primitive = mesh.primitives.emplace_back();
+            success = reader.read(primitive.materialIndex) && reader.read(primitive.indexType)
+                && reader.readSizedArray(primitive.vertices, arrayAlignment)
+                && reader.readSizedArray(primitive.indices, arrayAlignment);
+        }
+    }
+
+    success = success && reader.readSizedArray(instances, arrayAlignment)
+        && std::all_of(instances.begin(), instances.end(), [&](const dp::MeshInstance& instance) {
+            return instance.meshIndex < meshes.size();
+        });
+
+    for (uint64_t i = 0; success && i < header.textureCount; ++i) {
+        auto& texture = textures.emplace_back();
+        std::string path;
+        success = reader.readString(path) && reader.read(texture.width) && reader.read(texture.height)
+            && reader.read(texture.mipLevels) && reader.read(texture.format)
+            && reader.readSizedArray(texture.pixels, arrayAlignment);
+        texture.filePath = fs::path(std::u8string(path.begin(), path.end()));
+    }
+
+    if (!success) {
+        fmt::print(stderr, "Scene cache {} is corrupted.\n", getCachePath(sourcePath).string());
+        return false;
+    }
+
+    loader.materials = std::move(materials);
+    loader.meshes = std::move(meshes);
+    loader.instances = std::move(instances);
+    loader.textures = std::move(textures);
+    loader.dependencies = std::move(dependencies);
+    return true;
+}
+
+bool dp::SceneCache::beginWrite(const fs::path& sourcePath, const dp::FileLoader& loader, dp::BinaryFileWriter& writer) {
+    auto cachePath = getCachePath(sourcePath);
+    if (!writer.open(cachePath)) {
+        fmt::print(stderr, "Failed to create scene cache {}\n", cachePath.string());
+        return false;
+    }
+
+    Header header = {
+        .flags = getFlags(loader),
+        .sourceHash = hashSource(sourcePath),
+        .dependencyCount = loader.dependencies.size(),
+        .meshCount = loader.meshes.size(),
+        .materialCount = loader.materials.size(),
+        .textureCount = loader.textures.size(),
+    };
+    writer.write(header);
+
+    for (const auto& dependency : loader.dependencies) {
+        auto path = dependency.generic_u8string();
+        auto stamp = getDependencyStamp(dependency);
+        writer.writeString(std::string(path.begin(), path.end()));
+        writer.write(stamp.size);
+        writer.write(stamp.writeTime);
+    }
+
+    writer.writeSizedArray(loader.materials, arrayAlignment);
+
+    for (const auto& mesh : loader.meshes) {
+        writer.writeString(mesh.name);
+        writer.write(static_cast<uint64_t>(mesh.primitives.size()));
+        for (const auto& primitive : mesh.primitives) {
+            writer.write(primitive.materialIndex);
+            writer.write(primitive.indexType);
+            writer.writeSizedArray(primitive.vertices, arrayAlignment);
+            writer.writeSizedArray(primitive.indices, arrayAlignment);
+        }
+    }
+
+    writer.writeSizedArray(loader.instances, arrayAlignment);
+    return true;
+}
+
+void dp::SceneCache::writeTexture(dp::BinaryFileWriter& writer, const dp::TextureFile& texture) {
+    auto path = texture.filePath.generic_u8string();
+    writer.writeString(std::string(path.begin(), path.end()));
+    writer.write(texture.width);
+    writer.write(texture.height);
+    writer.write(texture.mipLevels);
+    writer.write(texture.format);
+    writer.writeSizedArray(texture.pixels, arrayAlignment);
+}
+
+bool dp::SceneCache::endWrite(const fs::path& sourcePath, dp::BinaryFileWriter& writer) {
+    if (!writer.commit()) {
+        fmt::print(stderr, "Failed to write scene cache {}\n", getCachePath(sourcePath).string());
+        return false;
+    }
+    return true;
+}
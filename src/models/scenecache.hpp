@@ -0,0 +1,78 @@
+#pragma once
+
+#include <filesystem>
+
+#include "mesh.hpp"
+
+namespace fs = std::filesystem;
+
+namespace dp {
+    class BinaryFileWriter;
+    class FileLoader;
+
+    /**
+     * A binary cache of a loaded scene, stored next to the source file with an additional
+     * .dpscene extension. It holds all meshes, instances, materials and decoded textures in the
+     * exact memory layout of dp::Vertex, dp::Index, dp::Material and dp::TextureFile::pixels,
+     * so that reading it back is just a few large copies out of a memory mapped file.
+     */
+    class SceneCache {
+        static constexpr uint32_t fileMagic = 0x43535044; // "DPSC"
+        /** Has to be incremented whenever the file layout changes. */
+        static constexpr uint32_t formatVersion = 4;
+        /** Every array inside the file is aligned to this, so it can be read in place. */
+        static constexpr size_t arrayAlignment = 16;
+
+        enum HeaderFlags : uint32_t {
+            /** The meshes have been processed by dp::MeshOptimizer. */
+            OptimizedMeshes = 1 << 0,
+        };
+
+        struct Header {
+            uint32_t magic = fileMagic;
+            uint32_t version = formatVersion;
+            // A change in any of the struct sizes also invalidates the cache.
+            uint32_t vertexSize = sizeof(dp::Vertex);
+            uint32_t indexSize = sizeof(dp::Index);
+            uint32_t materialSize = sizeof(dp::Material);
+            uint32_t flags = 0;
+            uint64_t sourceHash = 0;
+            uint64_t dependencyCount = 0;
+            uint64_t meshCount = 0;
+            uint64_t materialCount = 0;
+            uint64_t textureCount = 0;
+        };
+
+        /** The size and modification time of a file the source references, which are stored for each dependency. */
+        struct DependencyStamp {
+            uint64_t size = 0;
+            int64_t writeTime = 0;
+        };
+
+        /** Hashes the contents of the source file. */
+        [[nodiscard]] static auto hashSource(const fs::path& sourcePath) -> uint64_t;
+        /** Gets the stamp of a dependency. We don't hash its contents, as reading all textures would defeat the cache. */
+        [[nodiscard]] static auto getDependencyStamp(const fs::path& path) -> DependencyStamp;
+        /** Gets the header flags for the options of given loader, which have to match to use a cache. */
+        [[nodiscard]] static auto getFlags(const dp::FileLoader& loader) -> uint32_t;
+
+    public:
+        [[nodiscard]] static auto getCachePath(const fs::path& sourcePath) -> fs::path;
+
+        /**
+         * Reads the cache of given source file into the loader. Returns false if there is no valid cache,
+         * in which case the loader is left untouched.
+         */
+        [[nodiscard]] static bool read(const fs::path& sourcePath, dp::FileLoader& loader);
+        /**
+         * Opens the cache of given source file for writing, and writes everything of the loader but the
+         * textures. These are written one by one with writeTexture, so that the meshes can be moved out
+         * of the loader while the textures are still decoding. Returns false if the file could not be created.
+         */
+        static bool beginWrite(const fs::path& sourcePath, const dp::FileLoader& loader, dp::BinaryFileWriter& writer);
+        /** Writes the next texture, which have to be written in order of their indices. */
+        static void writeTexture(dp::BinaryFileWriter& writer, const dp::TextureFile& texture);
+        /** Replaces the cache with the written file, once every texture has been written. */
+        static bool endWrite(const fs::path& sourcePath, dp::BinaryFileWriter& writer);
+    };
+}
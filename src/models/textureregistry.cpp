@@ -0,0 +1,180 @@
+#include "textureregistry.hpp"
+
+#include <cstring>
+
+#include <fmt/core.h>
+
+#include "../vulkan/context.hpp"
+
+dp::TextureRegistry::TextureRegistry(const dp::Context& context, dp::UploadBatch& uploadBatch)
+        : ctx(context), uploadBatch(uploadBatch) {
+
+}
+
+auto dp::TextureRegistry::upload(const dp::TextureFile& textureFile) -> std::optional<dp::Texture> {
+    if (textureFile.pixels.empty()) {
+        fmt::print("Empty texture! {}\n", textureFile.filePath.string());
+        return std::nullopt;
+    }
+
+    // Generating mip levels requires blit support
+    uint32_t mipLevels = 1;
+    if (dp::Texture::formatSupportsBlit(ctx, textureFile.format)) {
+        mipLevels = textureFile.mipLevels;
+    }
+
+    dp::Texture texture(ctx, { textureFile.width, textureFile.height }, textureFile.filePath.filename().string());
+    texture.createTexture(textureFile.format, mipLevels);
+
+    // The upload is only recorded here, and submitted together with the other uploads of the frame.
+    // The pixels are staged first, as waiting for staging memory might submit the command buffer.
+    auto staging = uploadBatch.allocate(textureFile.pixels.size());
+    memcpy(staging.data, textureFile.pixels.data(), textureFile.pixels.size());
+
+    auto cmdBuffer = uploadBatch.getCommandBuffer();
+    texture.changeLayout(
+        cmdBuffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 },
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    VkBufferImageCopy copy = {
+        .bufferOffset = 0,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+        .imageExtent = texture.getImageSize3d(),
+    };
+    uploadBatch.copyToImage(staging, texture, texture.getImageLayout(), copy);
+
+    // The frames are submitted after the uploads, so the ray tracing shaders only have to wait for the transition.
+    if (mipLevels == 1) {
+        texture.changeLayout(
+            cmdBuffer, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 },
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR);
+    } else {
+        // Generate mipmaps. Generating mipmaps will automatically transition to SHADER_READ_ONLY_OPTIMAL
+        texture.generateMipmaps(cmdBuffer);
+    }
+
+    fmt::print("Recorded upload of texture {}!\n", textureFile.filePath.string());
+    return texture;
+}
+
+auto dp::TextureRegistry::evict(uint32_t slot) -> dp::Texture {
+    auto& entry = *slots[slot];
+    unusedSlots.erase(entry.lruPosition);
+    unusedSize -= entry.size;
+    slotsByHash.erase(entry.contentHash);
+    auto texture = entry.texture;
+
+    slots[slot].reset();
+    freeSlots.push_back(slot);
+    return texture;
+}
+
+void dp::TextureRegistry::init() {
+    // Empty texture file as we always need at least 1 texture to exist.
+    dp::TextureFile emptyTextureFile;
+    emptyTextureFile.width = 1; emptyTextureFile.height = 1;
+    emptyTextureFile.pixels = { 0xFF, 0xFF, 0xFF, 0xFF }; // White image
+    emptyTextureFile.format = VK_FORMAT_R8G8B8A8_SRGB;
+
+    // The default texture is not registered by hash, and is therefore never evicted.
+    slots.emplace_back().emplace(Entry {
+        .texture = *upload(emptyTextureFile),
+        .refCount = 1,
+        .size = emptyTextureFile.pixels.size(),
+    });
+}
+
+void dp::TextureRegistry::destroy() {
+    for (auto& slot : slots) {
+        if (slot.has_value())
+            slot->texture.destroy();
+    }
+    slots.clear();
+    freeSlots.clear();
+    slotsByHash.clear();
+    unusedSlots.clear();
+    unusedSize = 0;
+}
+
+auto dp::TextureRegistry::acquire(const dp::TextureFile& textureFile) -> uint32_t {
+    if (auto it = slotsByHash.find(textureFile.contentHash); it != slotsByHash.end()) {
+        auto& entry = *slots[it->second];
+        if (entry.refCount++ == 0) {
+            unusedSlots.erase(entry.lruPosition);
+            unusedSize -= entry.size;
+        }
+        return it->second;
+    }
+
+    auto texture = upload(textureFile);
+    if (!texture.has_value())
+        return defaultSlot;
+
+    uint32_t slot;
+    if (!freeSlots.empty()) {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    } else {
+        slot = static_cast<uint32_t>(slots.size());
+        slots.emplace_back();
+    }
+
+    // Approximate the memory used by the mip chain with an additional third.
+    VkDeviceSize size = textureFile.pixels.size();
+    if (textureFile.mipLevels > 1)
+        size += size / 3;
+
+    slots[slot].emplace(Entry {
+        .texture = *texture,
+        .contentHash = textureFile.contentHash,
+        .refCount = 1,
+        .size = size,
+    });
+    slotsByHash[textureFile.contentHash] = slot;
+    return slot;
+}
+
+void dp::TextureRegistry::release(uint32_t slot) {
+    if (slot == defaultSlot || slot >= slots.size() || !slots[slot].has_value())
+        return;
+
+    auto& entry = *slots[slot];
+    if (entry.refCount == 0 || --entry.refCount > 0)
+        return;
+
+    entry.lruPosition = unusedSlots.insert(unusedSlots.end(), slot);
+    unusedSize += entry.size;
+}
+
+auto dp::TextureRegistry::trim() -> std::vector<dp::Texture> {
+    // Unreferenced textures have been uploaded by an earlier frame's submit, so no upload in flight
+    // writes to them anymore.
+    std::vector<dp::Texture> evicted;
+    while (unusedSize > unusedBudget && !unusedSlots.empty()) {
+        evicted.push_back(evict(unusedSlots.front()));
+    }
+
+    if (!evicted.empty())
+        fmt::print("Evicted {} unused textures, {} textures remain resident.\n", evicted.size(), getResidentCount());
+    return evicted;
+}
+
+auto dp::TextureRegistry::getDescriptorInfos() -> std::vector<VkDescriptorImageInfo> {
+    // Empty slots still need a valid descriptor, so we point them at the default texture.
+    auto& defaultTexture = slots[defaultSlot]->texture;
+    std::vector<VkDescriptorImageInfo> descriptors(slots.size());
+    for (size_t i = 0; i < descriptors.size(); i++) {
+        auto& texture = slots[i].has_value() ? slots[i]->texture : defaultTexture;
+        descriptors[i].sampler = texture.getSampler();
+        descriptors[i].imageLayout = texture.getImageLayout();
+        descriptors[i].imageView = VkImageView(texture);
+    }
+    return descriptors;
+}
+
+auto dp::TextureRegistry::getResidentCount() const -> size_t {
+    return slots.size() - freeSlots.size();
+}
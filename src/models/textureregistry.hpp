@@ -0,0 +1,79 @@
+#pragma once
+
+#include <list>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "../vulkan/resource/texture.hpp"
+#include "../vulkan/resource/uploadbatch.hpp"
+#include "mesh.hpp"
+
+namespace dp {
+    // fwd.
+    class Context;
+
+    /**
+     * Keeps track of all textures resident on the GPU, keyed by the hash of their content.
+     * Textures used by multiple materials or across multiple scenes are therefore only
+     * uploaded once. Textures which are no longer referenced stay resident until their
+     * combined size exceeds unusedBudget, and are then evicted least recently used first.
+     */
+    class TextureRegistry {
+        struct Entry {
+            dp::Texture texture;
+            uint64_t contentHash = 0;
+            uint32_t refCount = 0;
+            VkDeviceSize size = 0;
+            /** Position inside unusedSlots, only valid while refCount is 0. */
+            std::list<uint32_t>::iterator lruPosition = {};
+        };
+
+        const dp::Context& ctx;
+
+        /** Each slot is an index into the texture descriptor array. Empty slots get reused. */
+        std::vector<std::optional<Entry>> slots;
+        std::vector<uint32_t> freeSlots;
+        std::unordered_map<uint64_t, uint32_t> slotsByHash;
+        /** Slots which are not referenced anymore, the least recently released at the front. */
+        std::list<uint32_t> unusedSlots;
+        VkDeviceSize unusedSize = 0;
+        /** Records the uploads of new textures, which the model manager submits once per frame. */
+        dp::UploadBatch& uploadBatch;
+
+        [[nodiscard]] auto upload(const dp::TextureFile& textureFile) -> std::optional<dp::Texture>;
+        /** Frees the slot, and returns its texture, which is not destroyed. */
+        [[nodiscard]] auto evict(uint32_t slot) -> dp::Texture;
+
+    public:
+        /** The slot of the 1x1 white texture, which always exists. */
+        static constexpr uint32_t defaultSlot = 0;
+
+        /** How much memory unreferenced textures may occupy before being evicted. */
+        VkDeviceSize unusedBudget = 256ull * 1024 * 1024;
+
+        explicit TextureRegistry(const dp::Context& context, dp::UploadBatch& uploadBatch);
+
+        /** Creates the default texture, which has to be done before any other texture is acquired. */
+        void init();
+        void destroy();
+
+        /**
+         * Returns the slot of a resident texture with the same content, or uploads the texture
+         * into a new slot. Each call has to be paired with a release(). Returns defaultSlot if
+         * the texture could not be uploaded. The texture can be used by any commands submitted
+         * after the upload batch, without waiting for it.
+         */
+        [[nodiscard]] auto acquire(const dp::TextureFile& textureFile) -> uint32_t;
+        /** Releases a reference to given slot. The texture stays resident until trim() evicts it. */
+        void release(uint32_t slot);
+        /**
+         * Evicts unreferenced textures until they fit within unusedBudget. The evicted textures are returned
+         * instead of destroyed, as the descriptor sets of the frames in flight might still point to them.
+         */
+        [[nodiscard]] auto trim() -> std::vector<dp::Texture>;
+
+        [[nodiscard]] auto getDescriptorInfos() -> std::vector<VkDescriptorImageInfo>;
+        [[nodiscard]] auto getResidentCount() const -> size_t;
+    };
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "mesh.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DP_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace dp {
+    /** A vertex attribute of floats in a buffer, where each element is stride bytes after the previous one. */
+    struct AttributeStream {
+        const uint8_t* data = nullptr;
+        size_t stride = 0;
+    };
+
+#ifdef DP_USE_SSE2
+    namespace detail {
+        // Loads exactly 12 or 8 bytes, so that the last element of a buffer is never read past.
+        inline __m128 loadFloat3(const uint8_t* src) {
+            __m128 xy = _mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src)));
+            return _mm_movelh_ps(xy, _mm_load_ss(reinterpret_cast<const float*>(src + 8)));
+        }
+
+        inline __m128 loadFloat2(const uint8_t* src) {
+            return _mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src)));
+        }
+    }
+#endif
+
+    /**
+     * Interleaves the positions, normals and UVs of count vertices into whole dp::Vertex rows,
+     * so that each vertex is written once instead of once per attribute. The streams may be
+     * strided, and a stream without data is written as zeroes.
+     */
+    inline void interleaveVertices(AttributeStream positions, AttributeStream normals, AttributeStream uvs,
+                                   size_t count, dp::Vertex* vertices) {
+        static_assert(sizeof(dp::Vertex) == 9 * sizeof(float));
+        static constexpr float zero[3] = {};
+        if (normals.data == nullptr)
+            normals = { reinterpret_cast<const uint8_t*>(zero), 0 };
+        if (uvs.data == nullptr)
+            uvs = { reinterpret_cast<const uint8_t*>(zero), 0 };
+
+        auto* dst = reinterpret_cast<uint8_t*>(vertices);
+        const uint8_t* pos = positions.data;
+        const uint8_t* normal = normals.data;
+        const uint8_t* uv = uvs.data;
+#ifdef DP_USE_SSE2
+        // Each row is put together as (pos.xyz, normal.x), (normal.yz, uv) and the padding.
+        for (size_t i = 0; i < count; ++i) {
+            __m128 p = detail::loadFloat3(pos);
+            __m128 n = detail::loadFloat3(normal);
+            __m128 t = detail::loadFloat2(uv);
+            __m128 zx = _mm_shuffle_ps(p, n, _MM_SHUFFLE(0, 0, 2, 2));
+            _mm_storeu_ps(reinterpret_cast<float*>(dst), _mm_shuffle_ps(p, zx, _MM_SHUFFLE(2, 0, 1, 0)));
+            _mm_storeu_ps(reinterpret_cast<float*>(dst + 16), _mm_shuffle_ps(n, t, _MM_SHUFFLE(1, 0, 2, 1)));
+            _mm_store_ss(reinterpret_cast<float*>(dst + 32), _mm_set_ss(1.0f));
+
+            dst += sizeof(dp::Vertex);
+            pos += positions.stride;
+            normal += normals.stride;
+            uv += uvs.stride;
+        }
+#else
+        for (size_t i = 0; i < count; ++i) {
+            auto* vertex = reinterpret_cast<dp::Vertex*>(dst);
+            memcpy(&vertex->pos, pos, sizeof(vertex->pos));
+            memcpy(&vertex->normals, normal, sizeof(vertex->normals));
+            memcpy(&vertex->uv, uv, sizeof(vertex->uv));
+            vertex->padding = 1.0f;
+
+            dst += sizeof(dp::Vertex);
+            pos += positions.stride;
+            normal += normals.stride;
+            uv += uvs.stride;
+        }
+#endif
+    }
+}
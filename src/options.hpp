@@ -1,6 +1,13 @@
 #pragma once
 
 namespace dp {
+    /** The values of the specialization constants of the ray tracing shaders. */
+    struct RenderVariant final {
+        const char* name;
+        uint32_t sampleCount;
+        uint32_t maxBounceDepth;
+    };
+
     struct EngineOptions final {
         const std::vector<const char*> scenes = {
             "models/glTF-Sample-Models/2.0/Sponza/glTF/Sponza.gltf",
@@ -8,5 +15,22 @@ namespace dp {
         };
 
         uint32_t sceneIndex = 0;
+
+        /** Store the vertices as dp::PackedVertex on the GPU. Takes effect when a scene is loaded. */
+        bool compactVertices = false;
+
+        /** Compact the BLASes after building them. Takes effect when a scene is loaded. */
+        bool compactAccelerationStructures = false;
+
+        /** A pipeline is built for each variant up front, so switching between them is instant. */
+        const std::vector<RenderVariant> renderVariants = {
+            { "Preview", 1, 2 },
+            { "High quality", 4, 5 },
+        };
+
+        uint32_t renderVariantIndex = 1;
+
+        /** Move the first instance of the scene back and forth, which refits and rebuilds the TLAS. */
+        bool animateInstance = false;
     };
 }
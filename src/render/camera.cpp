@@ -7,8 +7,12 @@ dp::Camera::Camera(const dp::Context& context)
     cameraBufferData.projectionInverse = glm::mat4(1.0f);
     cameraBufferData.viewInverse = glm::mat4(1.0f);
 
+    VkPhysicalDeviceProperties properties = {};
+    vkGetPhysicalDeviceProperties(ctx.physicalDevice, &properties);
+    frameStride = dp::Buffer::alignedSize(bufferSize, properties.limits.minUniformBufferOffsetAlignment);
+
     cameraBuffer.create(
-        bufferSize,
+        frameStride * ctx.framesInFlight,
         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
         VMA_MEMORY_USAGE_CPU_ONLY,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
@@ -32,13 +36,13 @@ void dp::Camera::updateMatrices() {
     cameraBufferData.viewInverse = glm::inverse(rotationMatrix * translationMatrix);
 }
 
-void dp::Camera::updateBuffer() {
+void dp::Camera::updateBuffer(const uint32_t frameIndex) {
     this->updateMatrices();
-    cameraBuffer.memoryCopy(&cameraBufferData, bufferSize);
+    cameraBuffer.memoryCopy(&cameraBufferData, bufferSize, frameStride * frameIndex);
 }
 
-VkDescriptorBufferInfo dp::Camera::getDescriptorInfo() const {
-    return cameraBuffer.getDescriptorInfo(bufferSize, 0);
+VkDescriptorBufferInfo dp::Camera::getDescriptorInfo(const uint32_t frameIndex) const {
+    return cameraBuffer.getDescriptorInfo(bufferSize, frameStride * frameIndex);
 }
 
 float dp::Camera::getFov() const {
@@ -12,7 +12,10 @@
 namespace dp {
     class Camera {
         const dp::Context ctx;
+        /** Holds a copy of the data for each frame in flight, so that recording a frame never overwrites one in use. */
         dp::Buffer cameraBuffer;
+        /** The offset between the copies, which satisfies the alignment of uniform buffer descriptor offsets. */
+        VkDeviceSize frameStride = 0;
 
         /** The data that will be in the buffer we use in the shaders */
         struct CameraBufferData {
@@ -40,10 +43,11 @@ namespace dp {
 
         void destroy();
 
-        /** Updates the descriptor buffer with new matrices */
-        void updateBuffer();
+        /** Updates the given frame's copy of the descriptor buffer with new matrices */
+        void updateBuffer(uint32_t frameIndex);
 
-        VkDescriptorBufferInfo getDescriptorInfo() const;
+        /** The descriptor for the given frame's copy of the buffer. */
+        VkDescriptorBufferInfo getDescriptorInfo(uint32_t frameIndex) const;
 
         float getFov() const;
 
@@ -1,5 +1,7 @@
 #include "ui.hpp"
 
+#include <algorithm>
+
 #include <imgui.h>
 #include <imgui_impl_vulkan.h>
 #include <imgui_impl_sdl.h>
@@ -73,9 +75,10 @@ void dp::Ui::init() {
         .PhysicalDevice = ctx.physicalDevice,
         .Device = ctx.device,
         .Queue = ctx.graphicsQueue,
+        .PipelineCache = ctx.pipelineCache,
         .DescriptorPool = descriptorPool,
         .MinImageCount = 3,
-        .ImageCount = 3,
+        .ImageCount = std::max<uint32_t>(3, ctx.framesInFlight),
         .MSAASamples = VK_SAMPLE_COUNT_1_BIT
     };
 
@@ -109,7 +112,30 @@ void dp::Ui::draw(dp::Engine& engine, const VkCommandBuffer cmdBuffer) {
             engine.modelManager.loadScene(engine.options.scenes[engine.options.sceneIndex]);
         }
     }
+    // These options are read while building the BLASes, so they can't change while a scene is
+    // streamed in, as that would mix the layouts of a single scene.
+    ImGui::BeginDisabled(reloadingScene);
+    if (ImGui::Checkbox("Compact vertices", &engine.options.compactVertices)) {
+        // The vertex layout is chosen when building the BLASes, so reload the scene.
+        reloadingScene = true;
+        engine.modelManager.loadScene(engine.options.scenes[engine.options.sceneIndex]);
+    }
+    if (ImGui::Checkbox("Compact BLASes", &engine.options.compactAccelerationStructures)) {
+        reloadingScene = true;
+        engine.modelManager.loadScene(engine.options.scenes[engine.options.sceneIndex]);
+    }
+    ImGui::EndDisabled();
+    ImGui::Combo("Quality",
+                 reinterpret_cast<int*>(&engine.options.renderVariantIndex),
+                 [](void* data, int index, const char** name) {
+                     *name = static_cast<const dp::RenderVariant*>(data)[index].name;
+                     return true;
+                 },
+                 const_cast<dp::RenderVariant*>(engine.options.renderVariants.data()),
+                 static_cast<int>(engine.options.renderVariants.size()));
+    ImGui::Checkbox("Animate an instance", &engine.options.animateInstance);
     ImGui::SliderFloat("Gamma", &engine.getConstants().gamma, 1.0f, 4.0f);
+    ImGui::Text("%.2f ms/frame", 1000.0f / ImGui::GetIO().Framerate);
 
     ImGui::End();
 
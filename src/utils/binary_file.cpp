@@ -0,0 +1,84 @@
+#include "binary_file.hpp"
+
+dp::BinaryReader::BinaryReader(const uint8_t* data, size_t size) : data(data), size(size) {
+}
+
+bool dp::BinaryReader::align(size_t alignment) {
+    size_t aligned = (offset + alignment - 1) & ~(alignment - 1);
+    if (aligned > size) return false;
+    offset = aligned;
+    return true;
+}
+
+bool dp::BinaryReader::read(void* destination, size_t byteCount) {
+    if (byteCount > getRemainingSize()) return false;
+    memcpy(destination, data + offset, byteCount);
+    offset += byteCount;
+    return true;
+}
+
+bool dp::BinaryReader::readString(std::string& string) {
+    uint64_t length = 0;
+    if (!read(length) || length > getRemainingSize()) return false;
+    string.assign(reinterpret_cast<const char*>(data + offset), length);
+    offset += length;
+    return true;
+}
+
+auto dp::BinaryReader::getRemainingData() const -> const uint8_t* {
+    return data + offset;
+}
+
+auto dp::BinaryReader::getRemainingSize() const -> size_t {
+    return size - offset;
+}
+
+dp::BinaryFileWriter::~BinaryFileWriter() {
+    if (stream.is_open()) {
+        stream.close();
+        std::error_code error;
+        fs::remove(temporaryPath, error);
+    }
+}
+
+bool dp::BinaryFileWriter::open(const fs::path& filePath) {
+    path = filePath;
+    temporaryPath = filePath;
+    temporaryPath += ".tmp";
+    offset = 0;
+    stream.open(temporaryPath, std::ios::binary | std::ios::trunc);
+    return stream.is_open();
+}
+
+bool dp::BinaryFileWriter::isOpen() const {
+    return stream.is_open();
+}
+
+bool dp::BinaryFileWriter::commit() {
+    stream.close();
+    std::error_code error;
+    if (!stream.fail())
+        fs::rename(temporaryPath, path, error);
+    if (stream.fail() || error) {
+        fs::remove(temporaryPath, error);
+        return false;
+    }
+    return true;
+}
+
+void dp::BinaryFileWriter::align(size_t alignment) {
+    static const char zeroes[64] = {};
+    size_t padding = ((offset + alignment - 1) & ~(alignment - 1)) - offset;
+    stream.write(zeroes, static_cast<std::streamsize>(padding));
+    offset += padding;
+}
+
+void dp::BinaryFileWriter::write(const void* source, size_t byteCount) {
+    stream.write(static_cast<const char*>(source), static_cast<std::streamsize>(byteCount));
+    offset += byteCount;
+}
+
+void dp::BinaryFileWriter::writeString(const std::string& string) {
+    write(static_cast<uint64_t>(string.size()));
+    write(string.data(), string.size());
+}
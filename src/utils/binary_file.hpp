@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace dp {
+    /**
+     * A bounds checked reader over the contents of a binary file, usually a dp::MappedFile.
+     * Every read returns false instead of reading past the end, so that corrupted files are
+     * rejected instead of crashing.
+     */
+    class BinaryReader {
+        const uint8_t* data;
+        size_t size;
+        size_t offset = 0;
+
+    public:
+        BinaryReader(const uint8_t* data, size_t size);
+
+        /** Skips to the next multiple of alignment, which has to be a power of two. */
+        bool align(size_t alignment);
+        bool read(void* destination, size_t byteCount);
+
+        template <typename T>
+        bool read(T& value) {
+            return read(&value, sizeof(T));
+        }
+
+        /** Reads given amount of elements, which have to be aligned for T inside the data. */
+        template <typename T>
+        bool readArray(std::vector<T>& vector, uint64_t count) {
+            if (count > getRemainingSize() / sizeof(T)) return false;
+            const auto* first = reinterpret_cast<const T*>(data + offset);
+            vector.assign(first, first + count);
+            offset += count * sizeof(T);
+            return true;
+        }
+
+        /** Reads an array written by BinaryFileWriter::writeSizedArray with the same alignment. */
+        template <typename T>
+        bool readSizedArray(std::vector<T>& vector, size_t alignment = 1) {
+            uint64_t count = 0;
+            return read(count) && align(alignment) && readArray(vector, count);
+        }
+
+        /** Reads a string, which is stored as its length followed by the characters. */
+        bool readString(std::string& string);
+
+        /** Gets the data that has not been read yet. */
+        [[nodiscard]] auto getRemainingData() const -> const uint8_t*;
+        [[nodiscard]] auto getRemainingSize() const -> size_t;
+    };
+
+    /**
+     * Writes a binary file into a temporary file next to it, which only replaces the file once
+     * commit() succeeds. A crash or failed write therefore never leaves a broken file behind.
+     */
+    class BinaryFileWriter {
+        fs::path path;
+        fs::path temporaryPath;
+        std::ofstream stream;
+        size_t offset = 0;
+
+    public:
+        explicit BinaryFileWriter() = default;
+        BinaryFileWriter(const BinaryFileWriter&) = delete;
+        BinaryFileWriter& operator=(const BinaryFileWriter&) = delete;
+        /** Removes the temporary file, if the writer has not been committed. */
+        ~BinaryFileWriter();
+
+        /** Creates the temporary file for given path. Returns false if it could not be created. */
+        bool open(const fs::path& filePath);
+        [[nodiscard]] bool isOpen() const;
+        /** Closes the temporary file and renames it to the final path. Returns false if any write failed. */
+        bool commit();
+
+        /** Pads with zeroes up to the next multiple of alignment, which has to be a power of two. */
+        void align(size_t alignment);
+        void write(const void* source, size_t byteCount);
+
+        template <typename T>
+        void write(const T& value) {
+            write(&value, sizeof(T));
+        }
+
+        /** Writes the element count, followed by the elements at given alignment. */
+        template <typename T>
+        void writeSizedArray(const std::vector<T>& vector, size_t alignment = 1) {
+            write(static_cast<uint64_t>(vector.size()));
+            align(alignment);
+            write(vector.data(), vector.size() * sizeof(T));
+        }
+
+        void writeString(const std::string& string);
+    };
+}
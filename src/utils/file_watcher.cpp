@@ -0,0 +1,117 @@
+#include "file_watcher.hpp"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+dp::FileWatcher::~FileWatcher() {
+    close();
+}
+
+#ifdef __linux__
+void dp::FileWatcher::addWatch(const fs::path& path) {
+    // Editors either write the file in place, or write a new file and move it over the old one.
+    int watchDescriptor = inotify_add_watch(inotifyHandle, path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (watchDescriptor >= 0)
+        watchedDirectories[watchDescriptor] = path;
+}
+
+bool dp::FileWatcher::watch(const fs::path& path) {
+    close();
+    directory = path;
+
+    inotifyHandle = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyHandle < 0)
+        return false;
+
+    // inotify does not watch subdirectories, so every directory needs its own watch.
+    addWatch(directory);
+    std::error_code error;
+    for (const auto& entry : fs::recursive_directory_iterator(directory, error)) {
+        if (entry.is_directory(error))
+            addWatch(entry.path());
+    }
+    return !watchedDirectories.empty();
+}
+
+void dp::FileWatcher::close() {
+    if (inotifyHandle >= 0)
+        ::close(inotifyHandle);
+    inotifyHandle = -1;
+    watchedDirectories.clear();
+}
+
+auto dp::FileWatcher::poll() -> std::vector<fs::path> {
+    std::vector<fs::path> changedFiles;
+    if (inotifyHandle < 0)
+        return changedFiles;
+
+    alignas(inotify_event) char buffer[4096];
+    ssize_t length;
+    while ((length = read(inotifyHandle, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t offset = 0; offset < length;) {
+            const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+            offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+
+            auto watched = watchedDirectories.find(event->wd);
+            if (event->len == 0 || watched == watchedDirectories.end())
+                continue;
+
+            auto path = watched->second / event->name;
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                    addWatch(path);
+            } else if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                       && std::find(changedFiles.begin(), changedFiles.end(), path) == changedFiles.end()) {
+                changedFiles.push_back(path);
+            }
+        }
+    }
+    return changedFiles;
+}
+#else
+auto dp::FileWatcher::scan() -> std::vector<fs::path> {
+    std::vector<fs::path> changedFiles;
+    std::error_code error;
+    for (const auto& entry : fs::recursive_directory_iterator(directory, error)) {
+        if (!entry.is_regular_file(error))
+            continue;
+        auto writeTime = entry.last_write_time(error);
+        auto [file, inserted] = writeTimes.try_emplace(entry.path().string(), writeTime);
+        if (!inserted && file->second != writeTime) {
+            file->second = writeTime;
+            changedFiles.push_back(entry.path());
+        } else if (inserted && lastScan != std::chrono::steady_clock::time_point {}) {
+            changedFiles.push_back(entry.path());
+        }
+    }
+    lastScan = std::chrono::steady_clock::now();
+    return changedFiles;
+}
+
+bool dp::FileWatcher::watch(const fs::path& path) {
+    close();
+    directory = path;
+    std::error_code error;
+    if (!fs::is_directory(directory, error))
+        return false;
+    scan();
+    return true;
+}
+
+void dp::FileWatcher::close() {
+    writeTimes.clear();
+    lastScan = {};
+}
+
+auto dp::FileWatcher::poll() -> std::vector<fs::path> {
+    // Walking the directory every frame would be wasteful, a few times a second is plenty.
+    if (lastScan == std::chrono::steady_clock::time_point {}
+        || std::chrono::steady_clock::now() - lastScan < std::chrono::milliseconds(500))
+        return {};
+    return scan();
+}
+#endif
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace dp {
+    /**
+     * Watches a directory and all of its subdirectories for files that have been written to.
+     * Uses inotify on Linux, and compares the modification times of all files everywhere else.
+     */
+    class FileWatcher {
+        fs::path directory;
+
+#ifdef __linux__
+        int inotifyHandle = -1;
+        /** The directory of each inotify watch descriptor. */
+        std::unordered_map<int, fs::path> watchedDirectories;
+
+        void addWatch(const fs::path& path);
+#else
+        std::unordered_map<std::string, fs::file_time_type> writeTimes;
+        std::chrono::steady_clock::time_point lastScan = {};
+
+        /** Scans the directory, and returns all files that are new or have a different modification time. */
+        auto scan() -> std::vector<fs::path>;
+#endif
+
+    public:
+        explicit FileWatcher() = default;
+        FileWatcher(const FileWatcher&) = delete;
+        FileWatcher& operator=(const FileWatcher&) = delete;
+        ~FileWatcher();
+
+        /** Starts watching given directory. Returns false if the directory cannot be watched. */
+        bool watch(const fs::path& path);
+        void close();
+
+        /** Returns the files that have been written to since the last call, without blocking. */
+        [[nodiscard]] auto poll() -> std::vector<fs::path>;
+    };
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace dp {
+    static constexpr uint64_t defaultHashSeed = 0xcbf29ce484222325ULL;
+
+    /** The finalizer of MurmurHash3, which spreads all input bits over the whole hash. */
+    [[nodiscard]] constexpr uint64_t mixHash(uint64_t hash) {
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ULL;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    /**
+     * A fast non-cryptographic 64-bit hash, processing 8 bytes at a time. Pass the
+     * result of a previous call as the seed to hash multiple ranges together.
+     */
+    [[nodiscard]] inline uint64_t hashBytes(const void* data, size_t size, uint64_t seed = defaultHashSeed) {
+        constexpr uint64_t prime = 0x100000001b3ULL;
+        const auto* bytes = static_cast<const uint8_t*>(data);
+        uint64_t hash = seed ^ (size * prime);
+
+        size_t i = 0;
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, bytes + i, sizeof(uint64_t));
+            hash = (hash ^ mixHash(word)) * prime;
+        }
+        uint64_t tail = 0;
+        memcpy(&tail, bytes + i, size - i);
+        hash = (hash ^ mixHash(tail)) * prime;
+
+        return mixHash(hash);
+    }
+
+    [[nodiscard]] inline uint64_t hashString(std::string_view string, uint64_t seed = defaultHashSeed) {
+        return hashBytes(string.data(), string.size(), seed);
+    }
+
+    template <typename T>
+    [[nodiscard]] inline uint64_t hashValue(const T& value, uint64_t seed = defaultHashSeed) {
+        return hashBytes(&value, sizeof(T), seed);
+    }
+}
@@ -0,0 +1,94 @@
+#include "mapped_file.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+dp::MappedFile::~MappedFile() {
+    close();
+}
+
+bool dp::MappedFile::open(const fs::path& path) {
+    close();
+
+#ifdef _WIN32
+    fileHandle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        fileHandle = nullptr;
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+        close();
+        return false;
+    }
+
+    mappingHandle = CreateFileMappingW(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle == nullptr) {
+        close();
+        return false;
+    }
+
+    data = static_cast<const uint8_t*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    if (data == nullptr) {
+        close();
+        return false;
+    }
+    size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int fileDescriptor = ::open(path.c_str(), O_RDONLY);
+    if (fileDescriptor < 0)
+        return false;
+
+    struct stat fileStat = {};
+    if (fstat(fileDescriptor, &fileStat) != 0 || fileStat.st_size == 0) {
+        ::close(fileDescriptor);
+        return false;
+    }
+
+    void* mapping = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    // The mapping keeps its own reference to the file.
+    ::close(fileDescriptor);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    madvise(mapping, fileStat.st_size, MADV_SEQUENTIAL);
+    data = static_cast<const uint8_t*>(mapping);
+    size = static_cast<size_t>(fileStat.st_size);
+#endif
+    return true;
+}
+
+void dp::MappedFile::close() {
+#ifdef _WIN32
+    if (data != nullptr)
+        UnmapViewOfFile(data);
+    if (mappingHandle != nullptr)
+        CloseHandle(mappingHandle);
+    if (fileHandle != nullptr)
+        CloseHandle(fileHandle);
+    mappingHandle = nullptr;
+    fileHandle = nullptr;
+#else
+    if (data != nullptr)
+        munmap(const_cast<uint8_t*>(data), size);
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+auto dp::MappedFile::getData() const -> const uint8_t* {
+    return data;
+}
+
+auto dp::MappedFile::getSize() const -> size_t {
+    return size;
+}
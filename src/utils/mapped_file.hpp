@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace dp {
+    /** A read-only memory mapped file. The mapping lives until close() or destruction. */
+    class MappedFile {
+        const uint8_t* data = nullptr;
+        size_t size = 0;
+
+#ifdef _WIN32
+        void* fileHandle = nullptr;
+        void* mappingHandle = nullptr;
+#endif
+
+    public:
+        explicit MappedFile() = default;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        ~MappedFile();
+
+        /** Maps the whole file. Returns false if the file could not be opened or is empty. */
+        bool open(const fs::path& path);
+        void close();
+
+        [[nodiscard]] auto getData() const -> const uint8_t*;
+        [[nodiscard]] auto getSize() const -> size_t;
+    };
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+
+namespace dp {
+    /**
+     * An unbounded lock-free queue for exactly one producing and one consuming thread.
+     * It is a linked list with a dummy head node: the producer only ever touches the tail,
+     * and the consumer only ever touches the head.
+     */
+    template <typename T>
+    class SpscQueue {
+        struct Node {
+            std::optional<T> value;
+            std::atomic<Node*> next = nullptr;
+        };
+
+        // Keep both ends on separate cache lines, as they are written by different threads.
+        alignas(64) Node* head;
+        alignas(64) Node* tail;
+
+    public:
+        SpscQueue() : head(new Node()), tail(head) {}
+        SpscQueue(const SpscQueue&) = delete;
+        SpscQueue& operator=(const SpscQueue&) = delete;
+
+        ~SpscQueue() {
+            while (head != nullptr) {
+                Node* next = head->next.load(std::memory_order_relaxed);
+                delete head;
+                head = next;
+            }
+        }
+
+        /** Appends a value. May only be called from the producing thread. */
+        void push(T value) {
+            auto* node = new Node();
+            node->value.emplace(std::move(value));
+            tail->next.store(node, std::memory_order_release);
+            tail = node;
+        }
+
+        /** Removes the oldest value, if any. May only be called from the consuming thread. */
+        [[nodiscard]] auto tryPop() -> std::optional<T> {
+            Node* next = head->next.load(std::memory_order_acquire);
+            if (next == nullptr)
+                return std::nullopt;
+
+            // The popped node becomes the new dummy head.
+            std::optional<T> value = std::move(next->value);
+            next->value.reset();
+            delete head;
+            head = next;
+            return value;
+        }
+    };
+}
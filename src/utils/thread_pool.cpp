@@ -0,0 +1,44 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+dp::ThreadPool::ThreadPool(uint32_t threadCount) {
+    if (threadCount == 0)
+        threadCount = std::max(std::thread::hardware_concurrency(), 1U);
+
+    workers.reserve(threadCount);
+    for (uint32_t i = 0; i < threadCount; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+dp::ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard guard(queueMutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void dp::ThreadPool::workerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock lock(queueMutex);
+            condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+            // We still finish all queued tasks before stopping.
+            if (stopping && tasks.empty())
+                return;
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
+
+auto dp::ThreadPool::getThreadCount() const -> uint32_t {
+    return static_cast<uint32_t>(workers.size());
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace dp {
+    /**
+     * A simple fixed size pool of worker threads. Tasks are executed in
+     * the order they were submitted, and their results can be waited on
+     * through the returned std::future.
+     */
+    class ThreadPool {
+        std::vector<std::thread> workers;
+        std::queue<std::function<void()>> tasks;
+
+        std::mutex queueMutex;
+        std::condition_variable condition;
+        bool stopping = false;
+
+        void workerLoop();
+
+    public:
+        /** Creates a pool with given thread count, or one thread per hardware thread if 0. */
+        explicit ThreadPool(uint32_t threadCount = 0);
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        ~ThreadPool();
+
+        [[nodiscard]] auto getThreadCount() const -> uint32_t;
+
+        template <typename F>
+        auto submit(F&& function) -> std::future<std::invoke_result_t<F>> {
+            // std::function requires copyable callables, so we wrap the task in a shared_ptr.
+            auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(function));
+            auto future = task->get_future();
+            {
+                std::lock_guard guard(queueMutex);
+                tasks.emplace([task]() { (*task)(); });
+            }
+            condition.notify_one();
+            return future;
+        }
+    };
+}
@@ -57,6 +57,9 @@ void dp::PhysicalDevice::create(const dp::Instance& instance, VkSurfaceKHR surfa
         VkPhysicalDeviceDescriptorIndexingFeatures descriptorIndexingFeatures = {
             .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES,
             .shaderSampledImageArrayNonUniformIndexing = true,
+            .descriptorBindingSampledImageUpdateAfterBind = true,
+            .descriptorBindingPartiallyBound = true,
+            .descriptorBindingVariableDescriptorCount = true,
             .runtimeDescriptorArray = true,
         };
         physicalDeviceSelector.add_required_extension_features(descriptorIndexingFeatures);
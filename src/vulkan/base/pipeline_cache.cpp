@@ -0,0 +1,112 @@
+#include "pipeline_cache.hpp"
+
+#include <cstring>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "../context.hpp"
+#include "../utils.hpp"
+#include "../../utils/binary_file.hpp"
+#include "../../utils/mapped_file.hpp"
+
+dp::PipelineCache::PipelineCache(const dp::Context& context) : ctx(context) {
+}
+
+dp::PipelineCache::operator VkPipelineCache() const {
+    return handle;
+}
+
+bool dp::PipelineCache::isCompatible(const uint8_t* data, size_t size) const {
+    VkPipelineCacheHeaderVersionOne header = {};
+    if (size < sizeof(header))
+        return false;
+    memcpy(&header, data, sizeof(header));
+
+    VkPhysicalDeviceProperties properties = {};
+    vkGetPhysicalDeviceProperties(ctx.physicalDevice, &properties);
+    return header.headerSize >= sizeof(header)
+        && header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        && header.vendorID == properties.vendorID
+        && header.deviceID == properties.deviceID
+        && memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void dp::PipelineCache::create(const fs::path& cachePath) {
+    path = cachePath;
+
+    // Any invalid or outdated file is simply ignored, and overwritten when saving.
+    dp::MappedFile file;
+    const uint8_t* cacheData = nullptr;
+    size_t cacheSize = 0;
+    if (file.open(path)) {
+        dp::BinaryReader reader(file.getData(), file.getSize());
+        FileHeader header = {};
+        const FileHeader expected = {};
+        bool valid = reader.read(header) && memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0
+            && header.version == expected.version;
+        for (uint32_t i = 0; valid && i < header.timingCount; ++i) {
+            std::string name;
+            double milliseconds = 0.0;
+            valid = reader.readString(name) && reader.read(milliseconds);
+            if (valid) coldCreationTimes[name] = milliseconds;
+        }
+
+        if (valid && isCompatible(reader.getRemainingData(), reader.getRemainingSize())) {
+            cacheData = reader.getRemainingData();
+            cacheSize = reader.getRemainingSize();
+            warm = true;
+        } else {
+            coldCreationTimes.clear();
+            fmt::print("Pipeline cache {} is invalid for this device, starting with a cold cache.\n", path.string());
+        }
+    }
+
+    VkPipelineCacheCreateInfo createInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = cacheSize,
+        .pInitialData = cacheData,
+    };
+    auto result = vkCreatePipelineCache(ctx.device, &createInfo, nullptr, &handle);
+    checkResult(ctx, result, "Failed to create pipeline cache");
+}
+
+void dp::PipelineCache::destroy() const {
+    vkDestroyPipelineCache(ctx.device, handle, nullptr);
+}
+
+void dp::PipelineCache::save() const {
+    size_t dataSize = 0;
+    auto result = vkGetPipelineCacheData(ctx.device, handle, &dataSize, nullptr);
+    checkResult(ctx, result, "Failed to get pipeline cache data");
+    std::vector<uint8_t> data(dataSize);
+    result = vkGetPipelineCacheData(ctx.device, handle, &dataSize, data.data());
+    checkResult(ctx, result, "Failed to get pipeline cache data");
+
+    dp::BinaryFileWriter writer;
+    if (!writer.open(path)) {
+        fmt::print(stderr, "Failed to create pipeline cache {}\n", path.string());
+        return;
+    }
+
+    writer.write(FileHeader { .timingCount = static_cast<uint32_t>(coldCreationTimes.size()) });
+    for (const auto& [name, milliseconds] : coldCreationTimes) {
+        writer.writeString(name);
+        writer.write(milliseconds);
+    }
+    writer.write(data.data(), dataSize);
+
+    if (!writer.commit())
+        fmt::print(stderr, "Failed to write pipeline cache {}\n", path.string());
+}
+
+void dp::PipelineCache::recordCreationTime(const std::string& pipelineName, double milliseconds) {
+    auto coldTime = coldCreationTimes.find(pipelineName);
+    if (!warm || coldTime == coldCreationTimes.end()) {
+        coldCreationTimes[pipelineName] = milliseconds;
+        fmt::print("Created pipeline {} in {:.2f}ms with a cold cache.\n", pipelineName, milliseconds);
+        return;
+    }
+    fmt::print("Created pipeline {} in {:.2f}ms with a warm cache, {:.2f}ms with a cold cache.\n",
+               pipelineName, milliseconds, coldTime->second);
+}
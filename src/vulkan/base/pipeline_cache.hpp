@@ -0,0 +1,52 @@
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <string>
+
+#include <vulkan/vulkan.h>
+
+namespace fs = std::filesystem;
+
+namespace dp {
+    class Context;
+
+    /**
+     * A VkPipelineCache shared by all pipeline builds, which persists across runs. The file stores
+     * the creation times of each pipeline measured with a cold cache, followed by the cache data.
+     */
+    class PipelineCache {
+        struct FileHeader {
+            char magic[4] = { 'D', 'P', 'P', 'C' };
+            uint32_t version = 2;
+            uint32_t timingCount = 0;
+        };
+
+        const dp::Context& ctx;
+        fs::path path;
+
+        VkPipelineCache handle = nullptr;
+        /** Whether valid cache data for this device was loaded from disk. */
+        bool warm = false;
+        /** The creation times of each pipeline with a cold cache, in milliseconds. */
+        std::map<std::string, double> coldCreationTimes;
+
+        /** Checks if given cache data has been created by this exact device and driver. */
+        [[nodiscard]] bool isCompatible(const uint8_t* data, size_t size) const;
+
+    public:
+        explicit PipelineCache(const dp::Context& context);
+        PipelineCache(const PipelineCache& cache) = default;
+
+        operator VkPipelineCache() const;
+
+        /** Creates the cache, with the data from given file if it exists and is valid for this device. */
+        void create(const fs::path& cachePath);
+        void destroy() const;
+        /** Writes the cache to disk. */
+        void save() const;
+
+        /** Prints the creation time of a pipeline, next to its creation time with a cold cache. */
+        void recordCreationTime(const std::string& pipelineName, double milliseconds);
+    };
+}
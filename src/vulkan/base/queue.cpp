@@ -44,6 +44,10 @@ VkResult dp::Queue::submit(const dp::Fence& fence, const VkSubmitInfo* submitInf
     return vkQueueSubmit(handle, 1, submitInfo, fence);
 }
 
+VkResult dp::Queue::submit(const VkSubmitInfo* submitInfo) const {
+    return vkQueueSubmit(handle, 1, submitInfo, VK_NULL_HANDLE);
+}
+
 VkResult dp::Queue::present(uint32_t imageIndex, const VkSwapchainKHR& swapchain, const dp::Semaphore& waitSemaphore) const {
     VkPresentInfoKHR presentInfo = {
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
@@ -35,6 +35,8 @@ namespace dp {
         /** Creates a new unique_lock, which will automatically lock the mutex. */
         [[nodiscard]] auto getLock() const -> std::unique_lock<std::mutex>;
         [[nodiscard]] auto submit(const dp::Fence& fence, const VkSubmitInfo* submitInfo) const -> VkResult;
+        /** Submits without a fence, for submissions that signal semaphores instead. */
+        [[nodiscard]] auto submit(const VkSubmitInfo* submitInfo) const -> VkResult;
         [[nodiscard]] auto present(uint32_t imageIndex, const VkSwapchainKHR& swapchain, const dp::Semaphore& waitSemaphore) const -> VkResult;
     };
 }
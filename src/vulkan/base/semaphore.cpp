@@ -1,6 +1,9 @@
 #include "semaphore.hpp"
 
 #include "../context.hpp"
+#include "../utils.hpp"
+
+#define DEFAULT_SEMAPHORE_TIMEOUT 100000000000
 
 dp::Semaphore::Semaphore(const dp::Context& context, std::string name)
         : ctx(context), name(std::move(name)) {
@@ -19,6 +22,23 @@ void dp::Semaphore::create(VkSemaphoreCreateFlags flags) {
     vkCreateSemaphore(ctx.device, &semaphoreCreateInfo, nullptr, &handle);
 }
 
+void dp::Semaphore::createTimeline(const uint64_t initialValue) {
+    VkSemaphoreTypeCreateInfo typeCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = initialValue,
+    };
+    VkSemaphoreCreateInfo semaphoreCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &typeCreateInfo,
+    };
+    auto result = vkCreateSemaphore(ctx.device, &semaphoreCreateInfo, nullptr, &handle);
+    checkResult(ctx, result, "Failed to create timeline semaphore");
+
+    if (!name.empty())
+        ctx.setDebugUtilsName(handle, name);
+}
+
 void dp::Semaphore::destroy() const {
     vkDestroySemaphore(ctx.device, handle, nullptr);
 }
@@ -26,3 +46,21 @@ void dp::Semaphore::destroy() const {
 auto dp::Semaphore::getHandle() const -> const VkSemaphore& {
     return handle;
 }
+
+auto dp::Semaphore::getCounterValue() const -> uint64_t {
+    uint64_t value = 0;
+    auto result = vkGetSemaphoreCounterValue(ctx.device, handle, &value);
+    checkResult(ctx, result, "Failed to get semaphore counter value");
+    return value;
+}
+
+void dp::Semaphore::wait(const uint64_t value) const {
+    VkSemaphoreWaitInfo waitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &handle,
+        .pValues = &value,
+    };
+    auto result = vkWaitSemaphores(ctx.device, &waitInfo, DEFAULT_SEMAPHORE_TIMEOUT);
+    checkResult(ctx, result, "Failed waiting on semaphore");
+}
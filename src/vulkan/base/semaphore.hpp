@@ -19,7 +19,14 @@ namespace dp {
         operator VkSemaphore() const;
 
         void create(VkSemaphoreCreateFlags flags = 0);
+        /** Creates a timeline semaphore, whose counter starts at given value. */
+        void createTimeline(uint64_t initialValue = 0);
         void destroy() const;
         [[nodiscard]] auto getHandle() const -> const VkSemaphore&;
+
+        /** Gets the current counter value of a timeline semaphore. */
+        [[nodiscard]] auto getCounterValue() const -> uint64_t;
+        /** Waits until the counter of a timeline semaphore has reached given value. */
+        void wait(uint64_t value) const;
     };
 }
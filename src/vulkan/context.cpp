@@ -3,6 +3,7 @@
 #define VMA_IMPLEMENTATION // Only needed in a single source file.
 #include <vk_mem_alloc.h>
 
+#include <algorithm>
 #include <utility>
 
 #include "VkBootstrap.h"
@@ -19,10 +20,8 @@
 dp::Context::Context(std::string name)
         : applicationName(std::move(name)),
           instance(*this),
-          presentCompleteSemaphore(*this, "presentCompleteSemaphore"),
-          renderCompleteSemaphore(*this, "renderCompleteSemaphore"),
-          renderFence(*this, "renderFence"),
-          graphicsQueue(*this, "graphicsQueue") {
+          graphicsQueue(*this, "graphicsQueue"),
+          pipelineCache(*this) {
 
 }
 
@@ -37,17 +36,20 @@ void dp::Context::init() {
     getVulkanFunctions();
     graphicsQueue.create(vkb::QueueType::graphics);
     commandPool = createCommandPool(device.getQueueIndex(vkb::QueueType::graphics), VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
-    drawCommandBuffer = createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, commandPool, false, 0, "drawCommandBuffer");
     buildSyncStructures();
     buildVmaAllocator();
+    pipelineCache.create("pipeline_cache.bin");
 }
 
 void dp::Context::destroy() const {
-    presentCompleteSemaphore.destroy();
-    renderCompleteSemaphore.destroy();
-    renderFence.destroy();
+    for (const auto& frame : frames) {
+        frame.presentCompleteSemaphore.destroy();
+        frame.renderCompleteSemaphore.destroy();
+        frame.renderFence.destroy();
+    }
 
     vkDestroyCommandPool(device, commandPool, nullptr);
+    pipelineCache.destroy();
 
     vmaDestroyAllocator(vmaAllocator);
 
@@ -56,13 +58,25 @@ void dp::Context::destroy() const {
 }
 
 void dp::Context::buildSyncStructures() {
-    renderFence.create(VK_FENCE_CREATE_SIGNALED_BIT);
-
-    presentCompleteSemaphore.create(0);
-    renderCompleteSemaphore.create(0);
-
-    setDebugUtilsName(renderCompleteSemaphore, "renderCompleteSemaphore");
-    setDebugUtilsName(presentCompleteSemaphore, "presentCompleteSemaphore");
+    frames.clear();
+    frames.reserve(framesInFlight);
+    for (uint32_t i = 0; i < framesInFlight; ++i) {
+        auto& frame = frames.emplace_back(FrameData {
+            .commandBuffer = createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, commandPool, false, 0, fmt::format("drawCommandBuffer{}", i)),
+            .renderFence = dp::Fence(*this, fmt::format("renderFence{}", i)),
+            .presentCompleteSemaphore = dp::Semaphore(*this),
+            .renderCompleteSemaphore = dp::Semaphore(*this),
+        });
+
+        // The fences start signaled, as there is nothing to wait for before the first frame.
+        frame.renderFence.create(VK_FENCE_CREATE_SIGNALED_BIT);
+        frame.presentCompleteSemaphore.create(0);
+        frame.renderCompleteSemaphore.create(0);
+
+        setDebugUtilsName(frame.renderCompleteSemaphore, fmt::format("renderCompleteSemaphore{}", i));
+        setDebugUtilsName(frame.presentCompleteSemaphore, fmt::format("presentCompleteSemaphore{}", i));
+    }
+    currentFrame = 0;
 }
 
 void dp::Context::buildVmaAllocator() {
@@ -79,8 +93,10 @@ void dp::Context::getVulkanFunctions() {
     vkCreateAccelerationStructureKHR = device.getFunctionAddress<PFN_vkCreateAccelerationStructureKHR>("vkCreateAccelerationStructureKHR");
     vkCreateRayTracingPipelinesKHR = device.getFunctionAddress<PFN_vkCreateRayTracingPipelinesKHR>("vkCreateRayTracingPipelinesKHR");
     vkCmdBuildAccelerationStructuresKHR = device.getFunctionAddress<PFN_vkCmdBuildAccelerationStructuresKHR>("vkCmdBuildAccelerationStructuresKHR");
+    vkCmdCopyAccelerationStructureKHR = device.getFunctionAddress<PFN_vkCmdCopyAccelerationStructureKHR>("vkCmdCopyAccelerationStructureKHR");
     vkCmdSetCheckpointNV = device.getFunctionAddress<PFN_vkCmdSetCheckpointNV>("vkCmdSetCheckpointNV");
     vkCmdTraceRaysKHR = device.getFunctionAddress<PFN_vkCmdTraceRaysKHR>("vkCmdTraceRaysKHR");
+    vkCmdWriteAccelerationStructuresPropertiesKHR = device.getFunctionAddress<PFN_vkCmdWriteAccelerationStructuresPropertiesKHR>("vkCmdWriteAccelerationStructuresPropertiesKHR");
     vkDestroyAccelerationStructureKHR = device.getFunctionAddress<PFN_vkDestroyAccelerationStructureKHR>("vkDestroyAccelerationStructureKHR");
     vkGetAccelerationStructureBuildSizesKHR = device.getFunctionAddress<PFN_vkGetAccelerationStructureBuildSizesKHR>("vkGetAccelerationStructureBuildSizesKHR");
     vkGetAccelerationStructureDeviceAddressKHR = device.getFunctionAddress<PFN_vkGetAccelerationStructureDeviceAddressKHR>("vkGetAccelerationStructureDeviceAddressKHR");
@@ -150,32 +166,53 @@ void dp::Context::oneTimeSubmit(const dp::Queue& queue, VkCommandPool pool,
     vkFreeCommandBuffers(device, pool, 1, &cmdBuffer);
 }
 
+auto dp::Context::getCurrentFrame() -> dp::FrameData& {
+    return frames[currentFrame];
+}
+
 auto dp::Context::waitForFrame(const Swapchain& swapchain) -> VkResult {
-    // Wait for fences, then acquire next image.
-    renderFence.wait();
-    renderFence.reset();
-    return swapchain.acquireNextImage(presentCompleteSemaphore, &currentImageIndex);
+    // Wait for this frame's last submission, then acquire next image. The fence is only reset
+    // right before the submit, so that waitForAllFrames never waits on a fence that won't signal.
+    auto& frame = getCurrentFrame();
+    frame.renderFence.wait();
+    return swapchain.acquireNextImage(frame.presentCompleteSemaphore, &currentImageIndex);
 }
 
 auto dp::Context::submitFrame(const Swapchain& swapchain) -> VkResult {
-    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT };
+    auto& frame = getCurrentFrame();
+    // The swapchain image is first accessed by the transition before the storage image is copied
+    // into it, which waits on the acquire at the same stage.
+    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_TRANSFER_BIT };
 
     VkSubmitInfo submitInfo = {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
         .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &presentCompleteSemaphore.getHandle(),
+        .pWaitSemaphores = &frame.presentCompleteSemaphore.getHandle(),
         .pWaitDstStageMask = waitStages,
         .commandBufferCount = 1,
-        .pCommandBuffers = &drawCommandBuffer,
+        .pCommandBuffers = &frame.commandBuffer,
         .signalSemaphoreCount = 1,
-        .pSignalSemaphores = &renderCompleteSemaphore.getHandle(),
+        .pSignalSemaphores = &frame.renderCompleteSemaphore.getHandle(),
     };
-    auto result = graphicsQueue.submit(renderFence, &submitInfo);
+    frame.renderFence.reset();
+    auto result = graphicsQueue.submit(frame.renderFence, &submitInfo);
     if (result != VK_SUCCESS) {
         checkResult(*this, result, "Failed to submit queue");
     }
 
-    return swapchain.queuePresent(graphicsQueue, currentImageIndex, renderCompleteSemaphore);
+    result = swapchain.queuePresent(graphicsQueue, currentImageIndex, frame.renderCompleteSemaphore);
+    currentFrame = (currentFrame + 1) % static_cast<uint32_t>(frames.size());
+    return result;
+}
+
+void dp::Context::waitForAllFrames() const {
+    std::vector<VkFence> fences;
+    fences.reserve(frames.size());
+    for (const auto& frame : frames) {
+        fences.push_back(frame.renderFence);
+    }
+    auto result = vkWaitForFences(device, static_cast<uint32_t>(fences.size()), fences.data(), VK_TRUE, DEFAULT_FENCE_TIMEOUT);
+    checkResult(*this, result, "Failed to wait for frames");
 }
 
 
@@ -188,6 +225,10 @@ void dp::Context::buildAccelerationStructures(const VkCommandBuffer cmdBuffer, u
     );
 }
 
+void dp::Context::copyAccelerationStructure(const VkCommandBuffer cmdBuffer, const VkCopyAccelerationStructureInfoKHR& copyInfo) const {
+    vkCmdCopyAccelerationStructureKHR(cmdBuffer, &copyInfo);
+}
+
 void dp::Context::setCheckpoint(VkCommandBuffer commandBuffer, const char* marker) const {
 #ifdef WITH_NV_AFTERMATH
     if (vkCmdSetCheckpointNV != nullptr)
@@ -208,12 +249,23 @@ void dp::Context::traceRays(const VkCommandBuffer commandBuffer, VkStridedDevice
     );
 }
 
+void dp::Context::writeAccelerationStructuresProperties(const VkCommandBuffer cmdBuffer, const std::vector<VkAccelerationStructureKHR>& handles, const VkQueryType queryType, const VkQueryPool queryPool, const uint32_t firstQuery) const {
+    vkCmdWriteAccelerationStructuresPropertiesKHR(
+        cmdBuffer,
+        static_cast<uint32_t>(handles.size()),
+        handles.data(),
+        queryType,
+        queryPool,
+        firstQuery
+    );
+}
+
 
 void dp::Context::buildRayTracingPipeline(VkPipeline* pPipelines, const std::vector<VkRayTracingPipelineCreateInfoKHR>& createInfos) const {
     vkCreateRayTracingPipelinesKHR(
         device,
         VK_NULL_HANDLE,
-        VK_NULL_HANDLE,
+        pipelineCache,
         createInfos.size(),
         createInfos.data(),
         nullptr,
@@ -238,9 +290,10 @@ auto dp::Context::createCommandPool(const uint32_t queueFamilyIndex, const VkCom
     return pool;
 }
 
-void dp::Context::createDescriptorPool(const uint32_t maxSets, const std::vector<VkDescriptorPoolSize>& poolSizes, VkDescriptorPool* descriptorPool) const {
+void dp::Context::createDescriptorPool(const uint32_t maxSets, const std::vector<VkDescriptorPoolSize>& poolSizes, VkDescriptorPool* descriptorPool, const VkDescriptorPoolCreateFlags flags) const {
     VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {};
     descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolCreateInfo.flags = flags;
     descriptorPoolCreateInfo.maxSets = maxSets;
     descriptorPoolCreateInfo.poolSizeCount = poolSizes.size();
     descriptorPoolCreateInfo.pPoolSizes = poolSizes.data();
@@ -276,6 +329,22 @@ uint32_t dp::Context::getBufferDeviceAddress(const VkBufferDeviceAddressInfoKHR&
     return vkGetBufferDeviceAddress(device, &addressInfo);
 }
 
+auto dp::Context::getAvailableMemory() const -> VkDeviceSize {
+    const VkPhysicalDeviceMemoryProperties* memoryProperties = nullptr;
+    vmaGetMemoryProperties(vmaAllocator, &memoryProperties);
+    std::vector<VmaBudget> budgets(memoryProperties->memoryHeapCount);
+    vmaGetHeapBudgets(vmaAllocator, budgets.data());
+
+    VkDeviceSize available = 0;
+    for (uint32_t i = 0; i < memoryProperties->memoryHeapCount; ++i) {
+        if (!isFlagSet(memoryProperties->memoryHeaps[i].flags, VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+            continue;
+        if (budgets[i].usage < budgets[i].budget)
+            available = std::max(available, budgets[i].budget - budgets[i].usage);
+    }
+    return available;
+}
+
 auto dp::Context::getCheckpointData(const dp::Queue& queue, uint32_t queryCount) const -> std::vector<VkCheckpointDataNV> {
 #ifdef WITH_NV_AFTERMATH
     if (vkGetQueueCheckpointDataNV == nullptr) return {};
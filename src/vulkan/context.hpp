@@ -2,6 +2,7 @@
 
 #include <functional>
 #include <string>
+#include <vector>
 
 #include <vulkan/vulkan.h>
 #include <vk_mem_alloc.h>
@@ -11,6 +12,7 @@
 #include "base/device.hpp"
 #include "base/fence.hpp"
 #include "base/instance.hpp"
+#include "base/pipeline_cache.hpp"
 #include "base/physical_device.hpp"
 #include "base/queue.hpp"
 #include "base/semaphore.hpp"
@@ -23,14 +25,24 @@ namespace dp {
     class Swapchain;
     class Window;
 
+    /** Everything the CPU needs to record a frame while the GPU is still busy with the previous ones. */
+    struct FrameData {
+        VkCommandBuffer commandBuffer = nullptr;
+        dp::Fence renderFence;
+        dp::Semaphore presentCompleteSemaphore;
+        dp::Semaphore renderCompleteSemaphore;
+    };
+
     // The global vulkan context. Includes the window, surface,
     // Vulkan instance and devices.
     class Context {
         PFN_vkCreateAccelerationStructureKHR vkCreateAccelerationStructureKHR = nullptr;
         PFN_vkCreateRayTracingPipelinesKHR vkCreateRayTracingPipelinesKHR = nullptr;
         PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructuresKHR = nullptr;
+        PFN_vkCmdCopyAccelerationStructureKHR vkCmdCopyAccelerationStructureKHR = nullptr;
         PFN_vkCmdSetCheckpointNV vkCmdSetCheckpointNV = nullptr;
         PFN_vkCmdTraceRaysKHR vkCmdTraceRaysKHR = nullptr;
+        PFN_vkCmdWriteAccelerationStructuresPropertiesKHR vkCmdWriteAccelerationStructuresPropertiesKHR = nullptr;
         PFN_vkDestroyAccelerationStructureKHR vkDestroyAccelerationStructureKHR = nullptr;
         PFN_vkGetAccelerationStructureBuildSizesKHR vkGetAccelerationStructureBuildSizesKHR = nullptr;
         PFN_vkGetAccelerationStructureDeviceAddressKHR vkGetAccelerationStructureDeviceAddressKHR = nullptr;
@@ -47,19 +59,20 @@ namespace dp {
         Window* window = nullptr;
         VkSurfaceKHR surface = nullptr;
 
-        // Sync structures
-        dp::Fence renderFence;
-        dp::Semaphore presentCompleteSemaphore;
-        dp::Semaphore renderCompleteSemaphore;
-
         dp::Instance instance;
         dp::PhysicalDevice physicalDevice;
         dp::Device device;
         dp::Queue graphicsQueue;
         VmaAllocator vmaAllocator = nullptr;
+        dp::PipelineCache pipelineCache;
 
         VkCommandPool commandPool = nullptr;
-        VkCommandBuffer drawCommandBuffer = nullptr;
+
+        /** How many frames may be recorded and executed at once. Has to be set before init(). */
+        uint32_t framesInFlight = 2;
+        std::vector<dp::FrameData> frames;
+        /** The index into frames of the frame being recorded. */
+        uint32_t currentFrame = 0;
 
         uint32_t currentImageIndex = 0;
 
@@ -78,21 +91,37 @@ namespace dp {
         void flushCommandBuffer(VkCommandBuffer commandBuffer, const dp::Queue& queue) const;
         void oneTimeSubmit(const dp::Queue& queue, VkCommandPool pool, const std::function<void(VkCommandBuffer)>& callback) const;
 
+        [[nodiscard]] auto getCurrentFrame() -> dp::FrameData&;
+        /** Waits until the current frame's previous submission has completed, then acquires the next image. */
         [[nodiscard]] auto waitForFrame(const Swapchain& swapchain) -> VkResult;
+        /** Submits and presents the current frame, and moves on to the next frame. */
         [[nodiscard]] auto submitFrame(const Swapchain& swapchain) -> VkResult;
+        /**
+         * Waits until every submitted frame has completed, so that resources used by any of them can be
+         * changed or destroyed. Unlike waiting for the device to be idle, this leaves other queues alone.
+         */
+        void waitForAllFrames() const;
 
         void buildAccelerationStructures(VkCommandBuffer cmdBuffer, uint32_t geometryCount, VkAccelerationStructureBuildGeometryInfoKHR* geometryInfos, VkAccelerationStructureBuildRangeInfoKHR** rangeInfos) const;
+        void copyAccelerationStructure(VkCommandBuffer cmdBuffer, const VkCopyAccelerationStructureInfoKHR& copyInfo) const;
         void setCheckpoint(VkCommandBuffer commandBuffer, const char* marker = nullptr) const;
         void traceRays(VkCommandBuffer commandBuffer, VkStridedDeviceAddressRegionKHR* raygenSbt, VkStridedDeviceAddressRegionKHR* missSbt, VkStridedDeviceAddressRegionKHR* hitSbt, VkStridedDeviceAddressRegionKHR* callableSbt, VkExtent3D size) const;
 
+        void writeAccelerationStructuresProperties(VkCommandBuffer cmdBuffer, const std::vector<VkAccelerationStructureKHR>& handles, VkQueryType queryType, VkQueryPool queryPool, uint32_t firstQuery = 0) const;
+
         void buildRayTracingPipeline(VkPipeline *pPipelines, const std::vector<VkRayTracingPipelineCreateInfoKHR>& createInfos) const;
         void createAccelerationStructure(VkAccelerationStructureCreateInfoKHR createInfo, VkAccelerationStructureKHR* accelerationStructure) const;
         [[nodiscard]] auto createCommandPool(uint32_t queueFamilyIndex, VkCommandPoolCreateFlags flags) const -> VkCommandPool;
-        void createDescriptorPool(uint32_t maxSets, const std::vector<VkDescriptorPoolSize>& poolSizes, VkDescriptorPool* descriptorPool) const;
+        void createDescriptorPool(uint32_t maxSets, const std::vector<VkDescriptorPoolSize>& poolSizes, VkDescriptorPool* descriptorPool, VkDescriptorPoolCreateFlags flags = 0) const;
         void destroyAccelerationStructure(VkAccelerationStructureKHR handle) const;
         [[nodiscard]] auto getAccelerationStructureBuildSizes(const uint32_t* primitiveCount, const VkAccelerationStructureBuildGeometryInfoKHR* buildGeometryInfo) const -> VkAccelerationStructureBuildSizesInfoKHR;
         [[nodiscard]] auto getAccelerationStructureDeviceAddress(VkAccelerationStructureKHR handle) const -> VkDeviceAddress;
         [[nodiscard]] auto getBufferDeviceAddress(const VkBufferDeviceAddressInfoKHR& addressInfo) const -> uint32_t;
+        /**
+         * Gets the memory that can still be allocated within the budget of the largest device local
+         * heap. Without VK_EXT_memory_budget, VMA estimates the budget.
+         */
+        [[nodiscard]] auto getAvailableMemory() const -> VkDeviceSize;
         [[nodiscard]] auto getCheckpointData(const dp::Queue& queue, uint32_t queryCount) const -> std::vector<VkCheckpointDataNV>;
         void getRayTracingShaderGroupHandles(const VkPipeline& pipeline, uint32_t groupCount, uint32_t dataSize, std::vector<uint8_t>& shaderHandles) const;
 
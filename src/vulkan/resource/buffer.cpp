@@ -15,15 +15,20 @@ dp::Buffer::Buffer(const dp::Context& context, std::string name)
 
 dp::Buffer::Buffer(const dp::Buffer& buffer)
         : ctx(buffer.ctx), name(buffer.name),
-          allocation(buffer.allocation), handle(buffer.handle), address(buffer.address) {
+          allocation(buffer.allocation), size(buffer.size), handle(buffer.handle), address(buffer.address) {
     
 }
 
+dp::Buffer::Buffer(dp::Buffer&& buffer) noexcept
+        : ctx(buffer.ctx), name(std::move(buffer.name)),
+          allocation(buffer.allocation), size(buffer.size), handle(buffer.handle), address(buffer.address) {
+}
+
 dp::Buffer& dp::Buffer::operator=(const dp::Buffer& buffer) {
     this->handle = buffer.handle;
     this->address = buffer.address;
     this->allocation = buffer.allocation;
-    this->handle = buffer.handle;
+    this->size = buffer.size;
     this->name = buffer.name;
     return *this;
 }
@@ -30,6 +30,8 @@ namespace dp {
         explicit Buffer(const Context& context);
         explicit Buffer(const Context& context, std::string name);
         Buffer(const Buffer& buffer);
+        /** Moves the name, so that containers of buffers don't copy it when they grow. */
+        Buffer(Buffer&& buffer) noexcept;
         ~Buffer() = default;
 
         Buffer& operator=(const Buffer& buffer);
@@ -0,0 +1,92 @@
+#include "stagingring.hpp"
+
+#include <utility>
+
+dp::StagingRing::StagingRing(const dp::Context& context, std::string name)
+        : buffer(context, std::move(name)) {
+
+}
+
+void dp::StagingRing::create(const VkDeviceSize newCapacity) {
+    capacity = newCapacity;
+    buffer.create(capacity);
+    buffer.mapMemory(reinterpret_cast<void**>(&mappedData));
+    head = tail = usedSize = unreleasedSize = 0;
+}
+
+void dp::StagingRing::destroy() {
+    if (mappedData != nullptr)
+        buffer.unmapMemory();
+    mappedData = nullptr;
+    buffer.destroy();
+    regions.clear();
+    capacity = head = tail = usedSize = unreleasedSize = 0;
+}
+
+auto dp::StagingRing::allocate(const VkDeviceSize size, const VkDeviceSize alignment) -> std::optional<dp::StagingAllocation> {
+    if (size == 0 || size > capacity)
+        return std::nullopt;
+    if (usedSize == 0)
+        head = tail = 0;
+
+    // While the used space does not wrap around, there is free space both behind the head and in
+    // front of the tail. Skipping to the front wastes the rest of the buffer, which is only reclaimed
+    // together with the allocation.
+    VkDeviceSize offset = dp::Buffer::alignedSize(head, alignment);
+    VkDeviceSize padding = 0;
+    if (usedSize == 0 || head > tail) {
+        if (offset + size <= capacity) {
+            padding = offset - head;
+        } else if (size <= tail) {
+            offset = 0;
+            padding = capacity - head;
+        } else {
+            return std::nullopt;
+        }
+    } else if (offset + size <= tail) {
+        padding = offset - head;
+    } else {
+        return std::nullopt;
+    }
+
+    usedSize += padding + size;
+    unreleasedSize += padding + size;
+    head = offset + size;
+    return dp::StagingAllocation {
+        .buffer = buffer.getHandle(),
+        .offset = offset,
+        .size = size,
+        .data = mappedData + offset,
+    };
+}
+
+void dp::StagingRing::release(const uint64_t token) {
+    if (unreleasedSize == 0)
+        return;
+
+    if (!regions.empty() && regions.back().token == token) {
+        regions.back().end = head;
+        regions.back().size += unreleasedSize;
+    } else {
+        regions.push_back({ .token = token, .end = head, .size = unreleasedSize });
+    }
+    unreleasedSize = 0;
+}
+
+void dp::StagingRing::reclaim(const uint64_t completedToken) {
+    while (!regions.empty() && regions.front().token <= completedToken) {
+        tail = regions.front().end;
+        usedSize -= regions.front().size;
+        regions.pop_front();
+    }
+    if (usedSize == 0)
+        head = tail = 0;
+}
+
+auto dp::StagingRing::getCapacity() const -> VkDeviceSize {
+    return capacity;
+}
+
+bool dp::StagingRing::isEmpty() const {
+    return usedSize == 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <deque>
+#include <optional>
+#include <string>
+
+#include <vulkan/vulkan.h>
+
+#include "stagingbuffer.hpp"
+
+namespace dp {
+    // fwd.
+    class Context;
+
+    /** A part of a staging buffer, which stays mapped while it is in use. */
+    struct StagingAllocation {
+        VkBuffer buffer = nullptr;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        /** Points to the mapped memory at offset. */
+        uint8_t* data = nullptr;
+    };
+
+    /**
+     * A large staging buffer that is mapped once, and suballocated linearly from front to back,
+     * wrapping around at its end. Allocations are grouped by the token of the submission that
+     * reads them, and their space is reclaimed once that token has completed.
+     */
+    class StagingRing {
+        struct Region {
+            uint64_t token = 0;
+            /** The offset just past the end of the region. */
+            VkDeviceSize end = 0;
+            /** The size of the region, including padding for alignment and wrapping. */
+            VkDeviceSize size = 0;
+        };
+
+        dp::StagingBuffer buffer;
+        uint8_t* mappedData = nullptr;
+
+        VkDeviceSize capacity = 0;
+        /** The offset of the next allocation. */
+        VkDeviceSize head = 0;
+        /** The offset of the oldest allocation still in use. */
+        VkDeviceSize tail = 0;
+        VkDeviceSize usedSize = 0;
+        /** The size allocated since the last call to release(), which does not belong to a region yet. */
+        VkDeviceSize unreleasedSize = 0;
+        std::deque<Region> regions;
+
+    public:
+        explicit StagingRing(const dp::Context& context, std::string name = "stagingRing");
+
+        void create(VkDeviceSize capacity);
+        void destroy();
+
+        /** Suballocates given size. Returns an empty optional if the ring does not have enough contiguous space left. */
+        [[nodiscard]] auto allocate(VkDeviceSize size, VkDeviceSize alignment) -> std::optional<dp::StagingAllocation>;
+        /** Marks everything allocated since the last call as in use, until given token has completed. */
+        void release(uint64_t token);
+        /** Reclaims the space of all regions whose token is at most given token. */
+        void reclaim(uint64_t completedToken);
+
+        [[nodiscard]] auto getCapacity() const -> VkDeviceSize;
+        [[nodiscard]] bool isEmpty() const;
+    };
+}
@@ -0,0 +1,198 @@
+#include "uploadbatch.hpp"
+
+#include <cstring>
+#include <utility>
+
+#include "../context.hpp"
+#include "../utils.hpp"
+#include "image.hpp"
+
+dp::UploadBatch::UploadBatch(const dp::Context& context, std::string name)
+        : ctx(context), name(std::move(name)), timeline(context, this->name + "Timeline"),
+          stagingRing(context, this->name + "StagingRing") {
+
+}
+
+void dp::UploadBatch::create(const VkDeviceSize stagingSize) {
+    commandPool = ctx.createCommandPool(ctx.device.getQueueIndex(vkb::QueueType::graphics), VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+    timeline.createTimeline(0);
+    lastToken = 0;
+    stagingRing.create(stagingSize);
+}
+
+void dp::UploadBatch::destroy() {
+    if (commandPool == nullptr)
+        return;
+
+    // Whatever has been recorded but not submitted is thrown away.
+    for (auto& stagingBuffer : recording.stagingBuffers) {
+        stagingBuffer.unmapMemory();
+        stagingBuffer.destroy();
+    }
+    recording = {};
+
+    wait(lastToken);
+    collect();
+
+    stagingRing.destroy();
+    vkDestroyCommandPool(ctx.device, commandPool, nullptr);
+    commandPool = nullptr;
+    timeline.destroy();
+}
+
+auto dp::UploadBatch::getCommandBuffer() -> VkCommandBuffer {
+    if (recording.commandBuffer == nullptr) {
+        recording.commandBuffer = ctx.createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, commandPool, true,
+                                                          VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, name);
+    }
+    return recording.commandBuffer;
+}
+
+auto dp::UploadBatch::tryAllocate(const VkDeviceSize size) -> std::optional<dp::StagingAllocation> {
+    if (size == 0)
+        return dp::StagingAllocation {};
+
+    std::optional<dp::StagingAllocation> allocation;
+    if (size > stagingRing.getCapacity()) {
+        // This would never fit into the ring, so it gets a buffer of its own.
+        auto& stagingBuffer = recording.stagingBuffers.emplace_back(ctx, name + "StagingBuffer");
+        stagingBuffer.create(size);
+        allocation = dp::StagingAllocation {
+            .buffer = stagingBuffer.getHandle(),
+            .size = size,
+        };
+        stagingBuffer.mapMemory(reinterpret_cast<void**>(&allocation->data));
+        ++statistics.allocationCount;
+    } else {
+        allocation = stagingRing.allocate(size, stagingAlignment);
+        if (!allocation.has_value()) {
+            collect();
+            allocation = stagingRing.allocate(size, stagingAlignment);
+        }
+    }
+
+    if (allocation.has_value()) {
+        ++statistics.uploadCount;
+        statistics.uploadedSize += size;
+    }
+    return allocation;
+}
+
+auto dp::UploadBatch::allocate(const VkDeviceSize size) -> dp::StagingAllocation {
+    while (true) {
+        auto allocation = tryAllocate(size);
+        if (allocation.has_value())
+            return *allocation;
+
+        // Wait for the oldest submission to give back its part of the ring. If everything has
+        // completed, the ring is filled by what is being recorded, which has to be submitted first.
+        if (!pending.empty()) {
+            wait(pending.front().token);
+        } else {
+            wait(submit());
+        }
+        collect();
+    }
+}
+
+void dp::UploadBatch::copyToBuffer(const dp::StagingAllocation& source, const dp::Buffer& destination, const VkDeviceSize destinationOffset) {
+    if (source.size == 0)
+        return;
+
+    VkBufferCopy copy = {
+        .srcOffset = source.offset,
+        .dstOffset = destinationOffset,
+        .size = source.size,
+    };
+    vkCmdCopyBuffer(getCommandBuffer(), source.buffer, destination.getHandle(), 1, &copy);
+}
+
+void dp::UploadBatch::copyToImage(const dp::StagingAllocation& source, const dp::Image& destination,
+                                  const VkImageLayout imageLayout, VkBufferImageCopy copy) {
+    copy.bufferOffset += source.offset;
+    vkCmdCopyBufferToImage(getCommandBuffer(), source.buffer, VkImage(destination), imageLayout, 1, &copy);
+}
+
+void dp::UploadBatch::uploadBuffer(const void* data, const VkDeviceSize size, const dp::Buffer& destination) {
+    auto staging = allocate(size);
+    if (size != 0)
+        memcpy(staging.data, data, size);
+    copyToBuffer(staging, destination);
+}
+
+void dp::UploadBatch::uploadImage(const void* data, const VkDeviceSize size, const dp::Image& destination,
+                                  const VkImageLayout imageLayout, VkBufferImageCopy copy) {
+    auto staging = allocate(size);
+    if (size != 0)
+        memcpy(staging.data, data, size);
+    copyToImage(staging, destination, imageLayout, copy);
+}
+
+auto dp::UploadBatch::submit() -> dp::UploadToken {
+    if (recording.commandBuffer == nullptr) {
+        // Staging memory that was allocated without recording any copies is not read by the GPU.
+        stagingRing.release(lastToken);
+        collect();
+        return lastToken;
+    }
+
+    auto result = vkEndCommandBuffer(recording.commandBuffer);
+    checkResult(ctx, result, "Failed to end upload command buffer");
+
+    recording.token = ++lastToken;
+    VkTimelineSemaphoreSubmitInfo timelineSubmitInfo = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &recording.token,
+    };
+    VkSubmitInfo submitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timelineSubmitInfo,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &recording.commandBuffer,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &timeline.getHandle(),
+    };
+
+    auto guard = std::move(ctx.graphicsQueue.getLock());
+    result = ctx.graphicsQueue.submit(&submitInfo);
+    guard.unlock();
+    checkResult(ctx, result, "Failed to submit uploads");
+
+    stagingRing.release(recording.token);
+    pending.push_back(std::move(recording));
+    recording = {};
+    collect();
+    return lastToken;
+}
+
+bool dp::UploadBatch::isComplete(const dp::UploadToken token) const {
+    return timeline.getCounterValue() >= token;
+}
+
+void dp::UploadBatch::wait(const dp::UploadToken token) const {
+    if (token > 0)
+        timeline.wait(token);
+}
+
+void dp::UploadBatch::collect() {
+    const auto completedToken = timeline.getCounterValue();
+    while (!pending.empty() && pending.front().token <= completedToken) {
+        auto& submission = pending.front();
+        for (auto& stagingBuffer : submission.stagingBuffers) {
+            stagingBuffer.unmapMemory();
+            stagingBuffer.destroy();
+        }
+        vkFreeCommandBuffers(ctx.device, commandPool, 1, &submission.commandBuffer);
+        pending.pop_front();
+    }
+    stagingRing.reclaim(completedToken);
+}
+
+auto dp::UploadBatch::getStatistics() const -> const dp::UploadStatistics& {
+    return statistics;
+}
+
+void dp::UploadBatch::resetStatistics() {
+    statistics = {};
+}
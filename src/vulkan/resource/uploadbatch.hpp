@@ -0,0 +1,105 @@
+#pragma once
+
+#include <deque>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "../base/semaphore.hpp"
+#include "stagingbuffer.hpp"
+#include "stagingring.hpp"
+
+namespace dp {
+    // fwd.
+    class Context;
+    class Image;
+
+    /** A value of the timeline semaphore of an UploadBatch, which is reached once a submission has completed. */
+    using UploadToken = uint64_t;
+
+    struct UploadStatistics {
+        size_t uploadCount = 0;
+        VkDeviceSize uploadedSize = 0;
+        /** The amount of staging buffers that have been allocated for these uploads. */
+        size_t allocationCount = 0;
+    };
+
+    /**
+     * Records many buffer and image uploads into a single command buffer, which is submitted
+     * at once. Submitting does not block, but returns a token which can be waited on. The data
+     * is staged in a ring buffer that stays mapped, whose space is reclaimed once the GPU has
+     * reached the token of the submission that used it.
+     */
+    class UploadBatch {
+        struct Submission {
+            dp::UploadToken token = 0;
+            VkCommandBuffer commandBuffer = nullptr;
+            /** Buffers for uploads which are too large for the staging ring. */
+            std::vector<dp::StagingBuffer> stagingBuffers;
+        };
+
+        /** Satisfies the offset alignment of buffer to image copies for every format we use. */
+        static constexpr VkDeviceSize stagingAlignment = 16;
+
+        const dp::Context& ctx;
+        std::string name;
+
+        /** A transient pool, as every command buffer is only submitted once. */
+        VkCommandPool commandPool = nullptr;
+        dp::Semaphore timeline;
+        dp::UploadToken lastToken = 0;
+        dp::StagingRing stagingRing;
+
+        /** The submission being recorded. Its command buffer is only begun once something is recorded. */
+        Submission recording;
+        /** The submitted batches, in the order of their tokens. */
+        std::deque<Submission> pending;
+        dp::UploadStatistics statistics = {};
+
+    public:
+        explicit UploadBatch(const dp::Context& context, std::string name = "uploadBatch");
+
+        /** Creates the command pool, and a staging ring of given size. */
+        void create(VkDeviceSize stagingSize);
+        /** Waits for all submissions to complete, and destroys everything. */
+        void destroy();
+
+        /**
+         * Gets the command buffer being recorded, for commands like layout transitions around the copies.
+         * Allocating staging memory might submit it, so it should be gotten after allocating.
+         */
+        [[nodiscard]] auto getCommandBuffer() -> VkCommandBuffer;
+
+        /**
+         * Allocates staging memory, which can be written until the batch is submitted. Returns an empty
+         * optional if the staging ring is full. Uploads larger than the ring get a buffer of their own.
+         */
+        [[nodiscard]] auto tryAllocate(VkDeviceSize size) -> std::optional<dp::StagingAllocation>;
+        /**
+         * Allocates staging memory like tryAllocate, but waits for earlier submissions to free up the ring
+         * if it is full. Might submit what has been recorded so far.
+         */
+        [[nodiscard]] auto allocate(VkDeviceSize size) -> dp::StagingAllocation;
+        void copyToBuffer(const dp::StagingAllocation& source, const dp::Buffer& destination, VkDeviceSize destinationOffset = 0);
+        /** Copies the staged pixels into the image, which has to be in the given layout when the copy executes. */
+        void copyToImage(const dp::StagingAllocation& source, const dp::Image& destination, VkImageLayout imageLayout, VkBufferImageCopy copy);
+        void uploadBuffer(const void* data, VkDeviceSize size, const dp::Buffer& destination);
+        void uploadImage(const void* data, VkDeviceSize size, const dp::Image& destination, VkImageLayout imageLayout, VkBufferImageCopy copy);
+
+        /**
+         * Submits everything recorded so far to the graphics queue, without waiting. Commands on the same
+         * queue which are submitted later only need a barrier to use the uploaded resources. Returns the
+         * token of the previous submission if nothing has been recorded.
+         */
+        auto submit() -> dp::UploadToken;
+        [[nodiscard]] bool isComplete(dp::UploadToken token) const;
+        void wait(dp::UploadToken token) const;
+        /** Frees the command buffers and staging memory of the submissions which have completed. */
+        void collect();
+
+        [[nodiscard]] auto getStatistics() const -> const dp::UploadStatistics&;
+        void resetStatistics();
+    };
+}
@@ -1,8 +1,37 @@
 #include "acceleration_structure.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
 #include "../context.hpp"
 #include "../resource/stagingbuffer.hpp"
 
+namespace {
+    /** Encodes a normal into the octahedral representation, packed as snorm16x2. */
+    uint32_t encodeOctahedralNormal(glm::vec3 normal) {
+        const float length = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+        if (length == 0.0f)
+            return glm::packSnorm2x16(glm::vec2(0.0f));
+
+        glm::vec2 encoded = glm::vec2(normal.x, normal.y) / length;
+        if (normal.z < 0.0f) {
+            // Fold the lower hemisphere over the diagonals.
+            const glm::vec2 sign = glm::vec2(encoded.x >= 0.0f ? 1.0f : -1.0f, encoded.y >= 0.0f ? 1.0f : -1.0f);
+            encoded = (1.0f - glm::abs(glm::vec2(encoded.y, encoded.x))) * sign;
+        }
+        return glm::packSnorm2x16(encoded);
+    }
+
+    dp::PackedVertex packVertex(const dp::Vertex& vertex) {
+        return {
+            .pos = vertex.pos,
+            .normal = encodeOctahedralNormal(vertex.normals),
+            .uv = glm::packHalf2x16(vertex.uv),
+        };
+    }
+}
+
 dp::AccelerationStructure::AccelerationStructure(const dp::Context& context, dp::AccelerationStructureType asType, std::string name)
         : ctx(context), type(asType),
         resultBuffer(ctx, std::move(name)), scratchBuffer(ctx, std::move(name)) {
@@ -38,6 +67,26 @@ void dp::AccelerationStructure::createStructure(VkAccelerationStructureBuildSize
     address = ctx.getAccelerationStructureDeviceAddress(handle);
 }
 
+auto dp::AccelerationStructure::compact(VkCommandBuffer const cmdBuffer, const VkDeviceSize compactedSize) -> dp::AccelerationStructure {
+    dp::AccelerationStructure original(*this);
+
+    VkAccelerationStructureBuildSizesInfoKHR compactedSizes = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
+        .accelerationStructureSize = compactedSize,
+    };
+    createResultBuffer(compactedSizes);
+    createStructure(compactedSizes);
+
+    VkCopyAccelerationStructureInfoKHR copyInfo = {
+        .sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR,
+        .src = original.handle,
+        .dst = handle,
+        .mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR,
+    };
+    ctx.copyAccelerationStructure(cmdBuffer, copyInfo);
+    return original;
+}
+
 void dp::AccelerationStructure::destroy() {
     ctx.destroyAccelerationStructure(handle);
     resultBuffer.destroy();
@@ -64,13 +113,9 @@ VkWriteDescriptorSetAccelerationStructureKHR dp::AccelerationStructure::getDescr
 
 dp::BottomLevelAccelerationStructure::BottomLevelAccelerationStructure(const dp::Context& context, dp::Mesh&& mesh)
         : AccelerationStructure(context, dp::AccelerationStructureType::BottomLevel, mesh.name),
-          mesh(mesh),
+          mesh(std::move(mesh)),
           vertexBuffer(ctx, "vertexBuffer"),
           indexBuffer(ctx, "indexBuffer"),
-          transformBuffer(ctx, "transformBuffer"),
-          vertexStagingBuffer(ctx, "vertexStagingBuffer"),
-          indexStagingBuffer(ctx, "indexStagingBuffer"),
-          transformStagingBuffer(ctx, "transformStagingBuffer"),
           geometryDescriptionBuffer(ctx, "geometryDescriptionBuffer") {
 }
 
@@ -83,6 +128,8 @@ void dp::BottomLevelAccelerationStructure::createGeometryDescriptionBuffer() {
             .meshBufferVertexOffset = prim.meshBufferVertexOffset,
             .meshBufferIndexOffset = prim.meshBufferIndexOffset,
             .materialIndex = prim.materialIndex,
+            .indexSize = prim.getIndexSize(),
+            .vertexEncoding = prim.vertexEncoding,
         });
     }
 
@@ -97,40 +144,42 @@ void dp::BottomLevelAccelerationStructure::createGeometryDescriptionBuffer() {
         geometryDescriptionBuffer.memoryCopy(geometryDescriptions.data(), descriptionSize);
 }
 
-void dp::BottomLevelAccelerationStructure::createMeshBuffers() {
+auto dp::BottomLevelAccelerationStructure::getStagingSize(const dp::Mesh& mesh, dp::VertexEncoding vertexEncoding) -> VkDeviceSize {
+    VkDeviceSize vertexSize = 0, indexSize = 0;
+    for (const auto& prim : mesh.primitives) {
+        vertexSize += prim.vertices.size() * (vertexEncoding == dp::VertexEncoding::Packed ? sizeof(dp::PackedVertex) : sizeof(dp::Vertex));
+        indexSize += dp::Buffer::alignedSize(prim.indices.size() * sizeof(dp::Index), sizeof(uint32_t));
+    }
+    return dp::Buffer::alignedSize(vertexSize, sizeof(uint32_t)) + indexSize;
+}
+
+void dp::BottomLevelAccelerationStructure::createMeshBuffers(dp::VertexEncoding vertexEncoding) {
     // We want to squash every primitive of the mesh into a single long buffer.
     // This will make the buffer quite convoluted, as there are vertices and indices
     // over and over again, but it should help for simplicity’s sake.
 
-    // First, we compute the total size of our mesh buffer.
+    // First, we compute the total size of our mesh buffer. Primitives whose vertices can all be
+    // addressed with 16 bits get compacted to 16-bit indices. The index offsets are kept aligned
+    // to 4 bytes, as the shaders read 16-bit indices in pairs.
     uint64_t totalVertexSize = 0, totalIndexSize = 0;
-    for (const auto& prim : mesh.primitives) {
-        totalVertexSize += prim.vertices.size() * dp::Primitive::vertexStride;
-        totalIndexSize += prim.indices.size() * sizeof(dp::Index);
-    }
-
-    vertexStagingBuffer.create(totalVertexSize);
-    indexStagingBuffer.create(totalIndexSize);
-    transformStagingBuffer.create(sizeof(VkTransformMatrixKHR));
-
-    // Copy the data into the big buffer at an offset.
-    uint64_t currentVertexOffset = 0, currentIndexOffset = 0;
+    bool hasVertices = false;
     for (auto& prim : mesh.primitives) {
-        uint64_t vertexSize = prim.vertices.size() * dp::Primitive::vertexStride;
-        uint64_t indexSize = prim.indices.size() * sizeof(dp::Index);
-
-        prim.meshBufferVertexOffset = currentVertexOffset;
-        prim.meshBufferIndexOffset = currentIndexOffset;
-
-        vertexStagingBuffer.memoryCopy(prim.vertices.data(), vertexSize, prim.meshBufferVertexOffset);
-        indexStagingBuffer.memoryCopy(prim.indices.data(), indexSize, prim.meshBufferIndexOffset);
-
-        currentVertexOffset += vertexSize;
-        currentIndexOffset += indexSize;
+        for (const auto& vertex : prim.vertices) {
+            minBounds = hasVertices ? glm::min(minBounds, vertex.pos) : vertex.pos;
+            maxBounds = hasVertices ? glm::max(maxBounds, vertex.pos) : vertex.pos;
+            hasVertices = true;
+        }
+
+        if (prim.indexType != VK_INDEX_TYPE_NONE_KHR) {
+            prim.indexType = prim.vertices.size() <= 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+        }
+        prim.vertexEncoding = vertexEncoding;
+        prim.meshBufferVertexOffset = totalVertexSize;
+        prim.meshBufferIndexOffset = totalIndexSize;
+        totalVertexSize += prim.vertices.size() * prim.getVertexStride();
+        totalIndexSize += dp::Buffer::alignedSize(prim.indices.size() * prim.getIndexSize(), sizeof(uint32_t));
     }
 
-    transformStagingBuffer.memoryCopy(&mesh.transform, sizeof(VkTransformMatrixKHR));
-
     // At last, we create the real buffers that reside on the GPU.
     VkBufferUsageFlags asInputBufferUsage =
         VK_BUFFER_USAGE_TRANSFER_DST_BIT |
@@ -139,18 +188,43 @@ void dp::BottomLevelAccelerationStructure::createMeshBuffers() {
         VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
     vertexBuffer.create(totalVertexSize, asInputBufferUsage, VMA_MEMORY_USAGE_GPU_ONLY);
     indexBuffer.create(totalIndexSize, asInputBufferUsage, VMA_MEMORY_USAGE_GPU_ONLY);
-    transformBuffer.create(sizeof(VkTransformMatrixKHR), asInputBufferUsage, VMA_MEMORY_USAGE_GPU_ONLY);
 }
 
-void dp::BottomLevelAccelerationStructure::copyMeshBuffers(VkCommandBuffer const cmdBuffer) {
-    vertexStagingBuffer.copyToBuffer(cmdBuffer, vertexBuffer);
-    indexStagingBuffer.copyToBuffer(cmdBuffer, indexBuffer);
-    transformStagingBuffer.copyToBuffer(cmdBuffer, transformBuffer);
-}
+void dp::BottomLevelAccelerationStructure::uploadMeshBuffers(dp::UploadBatch& uploadBatch, const dp::StagingAllocation& staging) {
+    // The indices follow the vertices inside the staging memory, at the offsets computed by createMeshBuffers.
+    const VkDeviceSize indexStagingOffset = dp::Buffer::alignedSize(vertexBuffer.getSize(), sizeof(uint32_t));
+    uint8_t* vertexData = staging.data;
+    uint8_t* indexData = staging.data + indexStagingOffset;
+
+    for (auto& prim : mesh.primitives) {
+        uint64_t vertexSize = prim.vertices.size() * prim.getVertexStride();
+        uint64_t indexSize = prim.indices.size() * prim.getIndexSize();
+
+        if (prim.vertexEncoding == dp::VertexEncoding::Packed) {
+            auto* dst = reinterpret_cast<dp::PackedVertex*>(vertexData + prim.meshBufferVertexOffset);
+            std::transform(prim.vertices.begin(), prim.vertices.end(), dst, packVertex);
+        } else if (vertexSize != 0) {
+            memcpy(vertexData + prim.meshBufferVertexOffset, prim.vertices.data(), vertexSize);
+        }
+
+        if (prim.indexType == VK_INDEX_TYPE_UINT16) {
+            auto* dst = reinterpret_cast<uint16_t*>(indexData + prim.meshBufferIndexOffset);
+            std::transform(prim.indices.begin(), prim.indices.end(), dst, [](dp::Index index) {
+                return static_cast<uint16_t>(index);
+            });
+        } else if (indexSize != 0) {
+            memcpy(indexData + prim.meshBufferIndexOffset, prim.indices.data(), indexSize);
+        }
+
+        // The staging memory now holds the only copy that is still needed.
+        prim.vertices.clear();
+        prim.vertices.shrink_to_fit();
+        prim.indices.clear();
+        prim.indices.shrink_to_fit();
+    }
 
-void dp::BottomLevelAccelerationStructure::destroyMeshBuffers() {
-    vertexStagingBuffer.destroy();
-    indexStagingBuffer.destroy();
+    uploadBatch.copyToBuffer({ staging.buffer, staging.offset, vertexBuffer.getSize(), vertexData }, vertexBuffer);
+    uploadBatch.copyToBuffer({ staging.buffer, staging.offset + indexStagingOffset, indexBuffer.getSize(), indexData }, indexBuffer);
 }
 
 dp::TopLevelAccelerationStructure::TopLevelAccelerationStructure(const dp::Context& ctx)
@@ -1,10 +1,11 @@
 #pragma once
 
+#include <type_traits>
 #include <vector>
 
 #include "../resource/buffer.hpp"
 #include "../../models/mesh.hpp"
-#include "../resource/stagingbuffer.hpp"
+#include "../resource/uploadbatch.hpp"
 
 namespace dp {
     // fwd.
@@ -30,10 +31,17 @@ namespace dp {
 
         explicit AccelerationStructure(const dp::Context& ctx, dp::AccelerationStructureType type, std::string name);
         AccelerationStructure(const AccelerationStructure& as) = default;
+        AccelerationStructure(AccelerationStructure&& as) noexcept = default;
 
         void createScratchBuffer(VkAccelerationStructureBuildSizesInfoKHR buildSizes);
         void createResultBuffer(VkAccelerationStructureBuildSizesInfoKHR buildSizes);
         void createStructure(VkAccelerationStructureBuildSizesInfoKHR buildSizes);
+        /**
+         * Records a compacting copy into a new structure of given size, which then replaces this one.
+         * Returns the original structure, which has to be destroyed once the copy has completed.
+         * The structure has to be built with VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR.
+         */
+        [[nodiscard]] auto compact(VkCommandBuffer cmdBuffer, VkDeviceSize compactedSize) -> dp::AccelerationStructure;
         void destroy();
         auto getBuildSizes(const uint32_t* primitiveCount,
                            VkAccelerationStructureBuildGeometryInfoKHR* buildGeometryInfo,
@@ -42,28 +50,43 @@ namespace dp {
     };
 
     struct BottomLevelAccelerationStructure final : public AccelerationStructure {
+        /** The vertices and indices of the primitives are released once uploadMeshBuffers has staged them. */
         dp::Mesh mesh;
-        dp::StagingBuffer transformStagingBuffer;
-        dp::StagingBuffer vertexStagingBuffer;
-        dp::StagingBuffer indexStagingBuffer;
 
     public:
-        dp::Buffer transformBuffer;
         dp::Buffer vertexBuffer;
         dp::Buffer indexBuffer;
 
+        /** The object space bounds of all vertices of the mesh, computed in createMeshBuffers. */
+        glm::vec3 minBounds = glm::vec3(0.0f);
+        glm::vec3 maxBounds = glm::vec3(0.0f);
+
         std::vector<dp::GeometryDescription> geometryDescriptions = {};
         /** A buffer containing instanceDescriptions of geometries inside BLASes. */
         dp::Buffer geometryDescriptionBuffer;
 
         explicit BottomLevelAccelerationStructure(const dp::Context& ctx, dp::Mesh&& mesh);
+        BottomLevelAccelerationStructure(const BottomLevelAccelerationStructure& blas) = default;
+        BottomLevelAccelerationStructure(BottomLevelAccelerationStructure&& blas) noexcept = default;
 
         void createGeometryDescriptionBuffer();
-        void createMeshBuffers();
-        void copyMeshBuffers(VkCommandBuffer cmdBuffer);
-        void destroyMeshBuffers();
+        /**
+         * Gets an upper bound of the staging memory uploadMeshBuffers needs, as the indices might still
+         * get compacted to 16 bits.
+         */
+        [[nodiscard]] static auto getStagingSize(const dp::Mesh& mesh, dp::VertexEncoding vertexEncoding) -> VkDeviceSize;
+        /** Creates the vertex and index buffers, with the vertices laid out in given encoding. */
+        void createMeshBuffers(dp::VertexEncoding vertexEncoding = dp::VertexEncoding::Full);
+        /**
+         * Writes the vertices and indices into given staging memory, and records their copies into the mesh
+         * buffers. Afterwards, the host copies of the vertices and indices are released.
+         */
+        void uploadMeshBuffers(dp::UploadBatch& uploadBatch, const dp::StagingAllocation& staging);
     };
 
+    // std::vector only moves its elements when growing if their move constructor can't throw.
+    static_assert(std::is_nothrow_move_constructible_v<dp::BottomLevelAccelerationStructure>);
+
     struct TopLevelAccelerationStructure final : public AccelerationStructure {
     public:
         explicit TopLevelAccelerationStructure(const dp::Context& ctx);
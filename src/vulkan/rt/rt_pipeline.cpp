@@ -1,5 +1,7 @@
 #include <vulkan/vulkan.h>
 
+#include <algorithm>
+#include <chrono>
 #include <utility>
 
 #include "../context.hpp"
@@ -11,12 +13,18 @@ dp::RayTracingPipeline::operator VkPipeline() const {
 }
 
 void dp::RayTracingPipeline::destroy(const dp::Context& ctx) const {
-    vkDestroyPipeline(ctx.device, pipeline, nullptr);
+    destroyVariants(ctx);
     vkDestroyPipelineLayout(ctx.device, pipelineLayout, nullptr);
     vkDestroyDescriptorPool(ctx.device, descriptorPool, nullptr);
     vkDestroyDescriptorSetLayout(ctx.device, descriptorLayout, nullptr);
 }
 
+void dp::RayTracingPipeline::destroyVariants(const dp::Context& ctx) const {
+    for (const auto& [key, variant] : variants) {
+        vkDestroyPipeline(ctx.device, variant, nullptr);
+    }
+}
+
 dp::RayTracingPipelineBuilder dp::RayTracingPipelineBuilder::create(Context& context, std::string pipelineName) {
     dp::RayTracingPipelineBuilder builder(context);
     builder.pipelineName = std::move(pipelineName);
@@ -100,6 +108,7 @@ dp::RayTracingPipelineBuilder& dp::RayTracingPipelineBuilder::addImageDescriptor
         .pImmutableSamplers = nullptr,
     };
     descriptorLayoutBindings.push_back(newBinding);
+    descriptorBindingFlags.push_back(0);
 
     VkWriteDescriptorSet newWrite = {
         .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
@@ -114,6 +123,35 @@ dp::RayTracingPipelineBuilder& dp::RayTracingPipelineBuilder::addImageDescriptor
     return *this;
 }
 
+dp::RayTracingPipelineBuilder& dp::RayTracingPipelineBuilder::addVariableImageDescriptor(const uint32_t binding, VkDescriptorImageInfo* imageInfos, const uint32_t imageCount, VkDescriptorType type, dp::ShaderStage stageFlags, const uint32_t maxCount) {
+    VkDescriptorSetLayoutBinding newBinding = {
+        .binding = binding,
+        .descriptorType = type,
+        .descriptorCount = maxCount,
+        .stageFlags = static_cast<VkShaderStageFlags>(stageFlags),
+        .pImmutableSamplers = nullptr,
+    };
+    descriptorLayoutBindings.push_back(newBinding);
+    descriptorBindingFlags.push_back(VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT
+                                     | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+                                     | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT);
+    variableDescriptorCount = maxCount;
+
+    if (imageCount != 0) {
+        VkWriteDescriptorSet newWrite = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .pNext = nullptr,
+            .dstBinding = binding,
+            .descriptorCount = std::min(imageCount, maxCount),
+            .descriptorType = type,
+            .pImageInfo = imageInfos,
+        };
+        descriptorWrites.push_back(newWrite);
+    }
+
+    return *this;
+}
+
 dp::RayTracingPipelineBuilder& dp::RayTracingPipelineBuilder::addBufferDescriptor(const uint32_t binding, VkDescriptorBufferInfo* bufferInfo, VkDescriptorType type, dp::ShaderStage stageFlags, uint32_t count) {
     VkDescriptorSetLayoutBinding newBinding = {
         .binding = binding,
@@ -123,6 +161,7 @@ dp::RayTracingPipelineBuilder& dp::RayTracingPipelineBuilder::addBufferDescripto
         .pImmutableSamplers = nullptr,
     };
     descriptorLayoutBindings.push_back(newBinding);
+    descriptorBindingFlags.push_back(0);
 
     VkWriteDescriptorSet newWrite = {
         .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
@@ -147,6 +186,7 @@ dp::RayTracingPipelineBuilder& dp::RayTracingPipelineBuilder::addAccelerationStr
     };
 
     descriptorLayoutBindings.push_back(newBinding);
+    descriptorBindingFlags.push_back(0);
 
     VkWriteDescriptorSet newWrite = {
         .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
@@ -170,40 +210,80 @@ dp::RayTracingPipelineBuilder& dp::RayTracingPipelineBuilder::addPushConstants(u
     return *this;
 }
 
+dp::RayTracingPipelineBuilder& dp::RayTracingPipelineBuilder::setDescriptorSetCount(uint32_t count) {
+    descriptorSetCount = count;
+    return *this;
+}
+
+dp::RayTracingPipelineBuilder& dp::RayTracingPipelineBuilder::setSpecializationConstants(const dp::SpecializationConstants& constants) {
+    specializationConstants = constants;
+    return *this;
+}
+
 dp::RayTracingPipeline dp::RayTracingPipelineBuilder::build() {
-    // Create the descriptor set layout.
+    // Create the descriptor set layout. Update after bind bindings require the whole
+    // layout and its pool to be created for update after bind.
+    const bool updateAfterBind = std::any_of(descriptorBindingFlags.begin(), descriptorBindingFlags.end(), [](VkDescriptorBindingFlags flags) {
+        return (flags & VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT) != 0;
+    });
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+        .bindingCount = static_cast<uint32_t>(descriptorBindingFlags.size()),
+        .pBindingFlags = descriptorBindingFlags.data(),
+    };
     VkDescriptorSetLayoutCreateInfo descriptorLayoutCreateInfo = {};
     descriptorLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorLayoutCreateInfo.pNext = &bindingFlagsCreateInfo;
+    if (updateAfterBind)
+        descriptorLayoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
     descriptorLayoutCreateInfo.bindingCount = static_cast<uint32_t>(descriptorLayoutBindings.size());
     descriptorLayoutCreateInfo.pBindings = descriptorLayoutBindings.data();
     vkCreateDescriptorSetLayout(ctx.device, &descriptorLayoutCreateInfo, nullptr, &descriptorSetLayout);
 
-    // Create descriptor pool and allocate sets.
-    static std::vector<VkDescriptorPoolSize> poolSizes = {
-        { VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1 },
-        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 10 },
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10 },
-        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 10 },
-    };
+    // Create descriptor pool and allocate sets. The pool holds exactly the descriptors of our sets.
+    std::vector<VkDescriptorPoolSize> poolSizes;
+    for (const auto& binding : descriptorLayoutBindings) {
+        auto poolSize = std::find_if(poolSizes.begin(), poolSizes.end(), [&](const VkDescriptorPoolSize& size) {
+            return size.type == binding.descriptorType;
+        });
+        if (poolSize == poolSizes.end())
+            poolSizes.push_back({ binding.descriptorType, binding.descriptorCount * descriptorSetCount });
+        else
+            poolSize->descriptorCount += binding.descriptorCount * descriptorSetCount;
+    }
 
-    ctx.createDescriptorPool(1, poolSizes, &descriptorPool);
+    ctx.createDescriptorPool(descriptorSetCount, poolSizes, &descriptorPool,
+                             updateAfterBind ? VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT : 0);
 
+    std::vector<VkDescriptorSetLayout> setLayouts(descriptorSetCount, descriptorSetLayout);
+    std::vector<uint32_t> variableDescriptorCounts(descriptorSetCount, variableDescriptorCount);
+    VkDescriptorSetVariableDescriptorCountAllocateInfo variableCountAllocateInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO,
+        .descriptorSetCount = descriptorSetCount,
+        .pDescriptorCounts = variableDescriptorCounts.data(),
+    };
     VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
     descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    if (variableDescriptorCount != 0)
+        descriptorSetAllocateInfo.pNext = &variableCountAllocateInfo;
     descriptorSetAllocateInfo.descriptorPool = descriptorPool;
-    descriptorSetAllocateInfo.descriptorSetCount = 1;
-    descriptorSetAllocateInfo.pSetLayouts = &descriptorSetLayout;
-    vkAllocateDescriptorSets(ctx.device, &descriptorSetAllocateInfo, &descriptorSet);
+    descriptorSetAllocateInfo.descriptorSetCount = descriptorSetCount;
+    descriptorSetAllocateInfo.pSetLayouts = setLayouts.data();
+    std::vector<VkDescriptorSet> descriptorSets(descriptorSetCount);
+    vkAllocateDescriptorSets(ctx.device, &descriptorSetAllocateInfo, descriptorSets.data());
 
-    // Copy the just allocated descriptor set to the write descriptors.
+    // Copy the just allocated descriptor sets to the write descriptors.
     // Then update the sets.
-    for (auto& write : descriptorWrites) {
-        write.dstSet = descriptorSet;
+    for (auto descriptorSet : descriptorSets) {
+        for (auto& write : descriptorWrites) {
+            write.dstSet = descriptorSet;
+        }
+        vkUpdateDescriptorSets(ctx.device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, VK_NULL_HANDLE);
     }
-    vkUpdateDescriptorSets(ctx.device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, VK_NULL_HANDLE);
 
     dp::RayTracingPipeline pipeline = {};
-    pipeline.descriptorSet = descriptorSet;
+    pipeline.descriptorPool = descriptorPool;
+    pipeline.descriptorSets = std::move(descriptorSets);
     pipeline.descriptorLayout = descriptorSetLayout;
 
     // Create pipeline layout
@@ -217,23 +297,56 @@ dp::RayTracingPipeline dp::RayTracingPipelineBuilder::build() {
     }
     vkCreatePipelineLayout(ctx.device, &pipelineLayoutCreateInfo, nullptr, &pipeline.pipelineLayout);
 
+    pipeline.pipeline = createPipeline(pipeline.pipelineLayout, specializationConstants, pipelineName);
+    pipeline.variants[specializationConstants.getKey()] = pipeline.pipeline;
+    return pipeline;
+}
+
+auto dp::RayTracingPipelineBuilder::buildVariant(dp::RayTracingPipeline& pipeline, dp::SpecializationConstants constants,
+                                                 const std::string& variantName) -> VkPipeline {
+    auto& variant = pipeline.variants[constants.getKey()];
+    if (variant == nullptr)
+        variant = createPipeline(pipeline.pipelineLayout, constants, pipelineName + "_" + variantName);
+    return variant;
+}
+
+dp::RayTracingPipeline dp::RayTracingPipelineBuilder::rebuild(const dp::RayTracingPipeline& pipeline) {
+    dp::RayTracingPipeline rebuilt = pipeline;
+    rebuilt.variants.clear();
+    rebuilt.pipeline = createPipeline(rebuilt.pipelineLayout, specializationConstants, pipelineName);
+    rebuilt.variants[specializationConstants.getKey()] = rebuilt.pipeline;
+    return rebuilt;
+}
+
+auto dp::RayTracingPipelineBuilder::createPipeline(VkPipelineLayout layout, dp::SpecializationConstants& constants,
+                                                   const std::string& name) -> VkPipeline {
     VkPhysicalDeviceRayTracingPipelinePropertiesKHR rtProperties = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR };
     VkPhysicalDeviceProperties2 deviceProperties = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, };
     deviceProperties.pNext = &rtProperties;
     vkGetPhysicalDeviceProperties2(ctx.physicalDevice, &deviceProperties);
 
+    // Constants that a stage doesn't declare are simply ignored, so every stage gets all of them.
+    std::vector<VkPipelineShaderStageCreateInfo> stages = shaderStages;
+    for (auto& stage : stages) {
+        stage.pSpecializationInfo = constants.getInfo();
+    }
+
     // Create RT pipeline
     VkRayTracingPipelineCreateInfoKHR pipelineCreateInfo = {};
     pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR;
-    pipelineCreateInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
-    pipelineCreateInfo.pStages = shaderStages.data();
+    pipelineCreateInfo.stageCount = static_cast<uint32_t>(stages.size());
+    pipelineCreateInfo.pStages = stages.data();
     pipelineCreateInfo.groupCount = static_cast<uint32_t>(shaderGroups.size());
     pipelineCreateInfo.pGroups = shaderGroups.data();
-    pipelineCreateInfo.layout = pipeline.pipelineLayout;
+    pipelineCreateInfo.layout = layout;
     pipelineCreateInfo.maxPipelineRayRecursionDepth = rtProperties.maxRayRecursionDepth;
 
-    ctx.buildRayTracingPipeline(&pipeline.pipeline, { pipelineCreateInfo });
+    VkPipeline pipeline = nullptr;
+    auto start = std::chrono::steady_clock::now();
+    ctx.buildRayTracingPipeline(&pipeline, { pipelineCreateInfo });
+    std::chrono::duration<double, std::milli> creationTime = std::chrono::steady_clock::now() - start;
+    ctx.pipelineCache.recordCreationTime(name, creationTime.count());
 
-    ctx.setDebugUtilsName(pipeline.pipeline, pipelineName);
+    ctx.setDebugUtilsName(pipeline, name);
     return pipeline;
 }
@@ -1,9 +1,12 @@
 #pragma once
 
 #include <initializer_list>
+#include <map>
 #include <string>
 #include <vector>
 
+#include "../shaders/shader.hpp"
+
 namespace dp {
     // fwd
     class Context;
@@ -24,11 +27,21 @@ namespace dp {
 
         VkDescriptorPool descriptorPool = nullptr;
         VkDescriptorSetLayout descriptorLayout = nullptr;
-        VkDescriptorSet descriptorSet = nullptr;
+        /** Identical descriptor sets, so that each frame in flight can have its own. */
+        std::vector<VkDescriptorSet> descriptorSets;
+
+        /**
+         * The pipelines for each set of specialization constants, keyed by
+         * SpecializationConstants::getKey. They all share the layout and descriptor sets,
+         * and include the pipeline created by the builder.
+         */
+        std::map<uint64_t, VkPipeline> variants;
 
         explicit operator VkPipeline() const;
 
         void destroy(const dp::Context& ctx) const;
+        /** Only destroys the variants, as a rebuilt pipeline shares everything else. */
+        void destroyVariants(const dp::Context& ctx) const;
     };
 
     class RayTracingPipelineBuilder {
@@ -39,11 +52,19 @@ namespace dp {
         std::vector<VkRayTracingShaderGroupCreateInfoKHR> shaderGroups;
 
         VkDescriptorPool descriptorPool = nullptr;
-        VkDescriptorSet descriptorSet = nullptr;
+        uint32_t descriptorSetCount = 1;
         VkDescriptorSetLayout descriptorSetLayout = nullptr;
         std::vector<VkDescriptorSetLayoutBinding> descriptorLayoutBindings;
+        /** The binding flags of each binding, in the same order as descriptorLayoutBindings. */
+        std::vector<VkDescriptorBindingFlags> descriptorBindingFlags;
+        /** The descriptor count of the variable sized binding, if there is one. */
+        uint32_t variableDescriptorCount = 0;
         std::vector<VkWriteDescriptorSet> descriptorWrites;
         VkPushConstantRange pushConstants;
+        dp::SpecializationConstants specializationConstants;
+
+        /** Creates the pipeline with given layout, using given specialization constants for all stages. */
+        [[nodiscard]] auto createPipeline(VkPipelineLayout layout, dp::SpecializationConstants& constants, const std::string& name) -> VkPipeline;
 
         explicit RayTracingPipelineBuilder(Context& context) : ctx(context) {}
 
@@ -52,12 +73,31 @@ namespace dp {
 
         RayTracingPipelineBuilder& addShaderGroup(RtShaderGroup group, std::initializer_list<dp::ShaderModule> shaders);
         RayTracingPipelineBuilder& addImageDescriptor(uint32_t binding, VkDescriptorImageInfo* imageInfo, VkDescriptorType type, dp::ShaderStage stageFlags, uint32_t count = 1);
+        /**
+         * Adds a partially bound, update after bind array of up to maxCount descriptors, of which the
+         * first imageCount are written. This has to be the binding with the highest number.
+         */
+        RayTracingPipelineBuilder& addVariableImageDescriptor(uint32_t binding, VkDescriptorImageInfo* imageInfos, uint32_t imageCount, VkDescriptorType type, dp::ShaderStage stageFlags, uint32_t maxCount);
         RayTracingPipelineBuilder& addBufferDescriptor(uint32_t binding, VkDescriptorBufferInfo* bufferInfo, VkDescriptorType type, dp::ShaderStage stageFlags, uint32_t count = 1);
         RayTracingPipelineBuilder& addAccelerationStructureDescriptor(uint32_t binding, VkWriteDescriptorSetAccelerationStructureKHR* asInfo, VkDescriptorType type, dp::ShaderStage stageFlags);
         RayTracingPipelineBuilder& addPushConstants(uint32_t pushConstantSize, dp::ShaderStage shaderStage);
+        /** Sets how many descriptor sets to allocate. All of them get the same descriptors written. */
+        RayTracingPipelineBuilder& setDescriptorSetCount(uint32_t count);
+        /** Sets the specialization constants of the pipeline created by build(). */
+        RayTracingPipelineBuilder& setSpecializationConstants(const dp::SpecializationConstants& constants);
 
         // Builds the descriptor set layout and pipeline layout, then creates
         // a VkRayTracingPipeline based on that.
         RayTracingPipeline build();
+        /**
+         * Gets the variant of an already built pipeline for given specialization constants,
+         * creating it with the same shaders and layout if it doesn't exist yet.
+         */
+        auto buildVariant(dp::RayTracingPipeline& pipeline, dp::SpecializationConstants constants, const std::string& variantName) -> VkPipeline;
+        /**
+         * Creates a pipeline with the shaders of this builder, which shares the layouts and descriptor
+         * sets of given pipeline. Its variants have to be built again with buildVariant.
+         */
+        RayTracingPipeline rebuild(const dp::RayTracingPipeline& pipeline);
     };
 } // namespace dp
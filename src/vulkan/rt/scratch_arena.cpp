@@ -0,0 +1,83 @@
+#include "scratch_arena.hpp"
+
+#include <algorithm>
+
+#include "../context.hpp"
+
+dp::ScratchArena::ScratchArena(const dp::Context& context) : ctx(context) {
+}
+
+void dp::ScratchArena::init(const VkDeviceSize scratchAlignment) {
+    alignment = std::max(scratchAlignment, static_cast<VkDeviceSize>(1));
+}
+
+void dp::ScratchArena::destroy() {
+    for (auto& block : blocks) {
+        block.destroy();
+    }
+    blocks.clear();
+    currentBlock = 0;
+    blockOffset = 0;
+    usedSize = 0;
+    peakUsedSize = 0;
+}
+
+bool dp::ScratchArena::fits(const VkDeviceSize size) const {
+    return usedSize == 0 || usedSize + size <= budget;
+}
+
+auto dp::ScratchArena::allocate(const VkDeviceSize size) -> VkDeviceAddress {
+    // The scratch offset alignment applies to the device address, which might be less
+    // aligned than that for the start of a block.
+    auto alignedAddress = [this](const dp::Buffer& block, VkDeviceSize offset) {
+        return dp::Buffer::alignedSize(block.getDeviceAddress() + offset, alignment);
+    };
+    auto fitsBlock = [&](const dp::Buffer& block, VkDeviceSize offset) {
+        return alignedAddress(block, offset) + size <= block.getDeviceAddress() + block.getSize();
+    };
+
+    // Move on to the next block that can hold the allocation, creating a new one if needed.
+    while (currentBlock < blocks.size() && !fitsBlock(blocks[currentBlock], blockOffset)) {
+        ++currentBlock;
+        blockOffset = 0;
+    }
+    if (currentBlock == blocks.size()) {
+        auto& block = blocks.emplace_back(ctx, "scratchArenaBlock");
+        block.create(
+            std::max(blockSize, size + alignment),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            VMA_MEMORY_USAGE_GPU_ONLY,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+        );
+    }
+
+    auto& block = blocks[currentBlock];
+    const VkDeviceAddress address = alignedAddress(block, blockOffset);
+    blockOffset = address + size - block.getDeviceAddress();
+
+    usedSize += size;
+    peakUsedSize = std::max(peakUsedSize, usedSize);
+    return address;
+}
+
+void dp::ScratchArena::reset() {
+    currentBlock = 0;
+    blockOffset = 0;
+    usedSize = 0;
+}
+
+auto dp::ScratchArena::getBlockCount() const -> size_t {
+    return blocks.size();
+}
+
+auto dp::ScratchArena::getAllocatedSize() const -> VkDeviceSize {
+    VkDeviceSize size = 0;
+    for (const auto& block : blocks) {
+        size += block.getSize();
+    }
+    return size;
+}
+
+auto dp::ScratchArena::getPeakUsedSize() const -> VkDeviceSize {
+    return peakUsedSize;
+}
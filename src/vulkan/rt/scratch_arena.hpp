@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+
+#include "../resource/buffer.hpp"
+
+namespace dp {
+    // fwd.
+    class Context;
+
+    /**
+     * Suballocates scratch memory for acceleration structure builds from a few large blocks.
+     * Allocations are only ever freed all at once through reset(), which may only be called
+     * once all builds using the previous allocations have completed, or after recording a
+     * barrier between the builds that used them and the builds that follow.
+     */
+    class ScratchArena {
+        const dp::Context& ctx;
+
+        std::vector<dp::Buffer> blocks;
+        size_t currentBlock = 0;
+        /** The offset into the current block at which the next allocation starts. */
+        VkDeviceSize blockOffset = 0;
+        VkDeviceSize alignment = 256;
+
+        /** The scratch memory handed out since the last reset. */
+        VkDeviceSize usedSize = 0;
+        VkDeviceSize peakUsedSize = 0;
+
+    public:
+        /** The minimum size of each block. Larger builds get a block of their own size. */
+        VkDeviceSize blockSize = 32ull * 1024 * 1024;
+        /** How much scratch memory builds may use before they have to wait for previous builds. */
+        VkDeviceSize budget = 128ull * 1024 * 1024;
+
+        explicit ScratchArena(const dp::Context& context);
+
+        /** Sets the alignment of each allocation, usually minAccelerationStructureScratchOffsetAlignment. */
+        void init(VkDeviceSize scratchAlignment);
+        /** Destroys all blocks. The arena can still be used afterwards, and will allocate new blocks. */
+        void destroy();
+
+        /**
+         * Whether an allocation of given size still fits into the budget. An empty arena
+         * always accepts an allocation, so that builds larger than the budget still work.
+         */
+        [[nodiscard]] bool fits(VkDeviceSize size) const;
+        /** Allocates an aligned range of given size, and returns its device address. */
+        [[nodiscard]] auto allocate(VkDeviceSize size) -> VkDeviceAddress;
+        /** Frees all allocations, keeping the blocks for the next builds. */
+        void reset();
+
+        [[nodiscard]] auto getBlockCount() const -> size_t;
+        /** The total size of all blocks. */
+        [[nodiscard]] auto getAllocatedSize() const -> VkDeviceSize;
+        /** The largest amount of scratch memory that was in use at once since the last call to destroy(). */
+        [[nodiscard]] auto getPeakUsedSize() const -> VkDeviceSize;
+    };
+}
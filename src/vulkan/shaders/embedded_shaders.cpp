@@ -0,0 +1,11 @@
+#include "embedded_shaders.hpp"
+
+#include <spirv_shaders.hpp> // Generated by cmake/embed_spirv.cmake.
+
+auto dp::findEmbeddedShader(const std::string& filename) -> std::span<const uint32_t> {
+    for (const auto& shader : dp::spirv::shaders) {
+        if (shader.path == filename)
+            return shader.binary;
+    }
+    return {};
+}
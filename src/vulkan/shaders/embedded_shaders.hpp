@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+
+namespace dp {
+    /**
+     * Finds the SPIR-V of a shader that has been compiled and embedded at build time, by the path
+     * its source would be loaded from. Returns an empty span if there is no such shader.
+     */
+    [[nodiscard]] auto findEmbeddedShader(const std::string& filename) -> std::span<const uint32_t>;
+}
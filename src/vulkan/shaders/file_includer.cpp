@@ -1,5 +1,6 @@
 #include "file_includer.hpp"
 
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 
@@ -40,6 +41,12 @@ void dp::FileIncluder::ReleaseInclude(shaderc_include_result *includeResult) {
     delete includeResult;
 }
 
+auto dp::FileIncluder::getIncludedFiles() const -> std::vector<std::string> {
+    std::vector<std::string> files(allIncludedFiles.begin(), allIncludedFiles.end());
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
 std::string dp::FileIncluder::readFileAsString(const std::string& filename) {
     std::ifstream is(filename, std::ios::in);
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <unordered_set>
+#include <vector>
 
 #include <shaderc/shaderc.hpp>
 
@@ -27,5 +28,8 @@ namespace dp {
                                            size_t includeDepth) override;
 
         void ReleaseInclude(shaderc_include_result* includeResult) override;
+
+        /** Gets the paths of all files included so far, sorted so that they can be compared. */
+        [[nodiscard]] auto getIncludedFiles() const -> std::vector<std::string>;
     };
 }
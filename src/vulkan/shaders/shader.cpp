@@ -1,15 +1,26 @@
 #include "shader.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <utility>
 
+#include <fmt/core.h>
+
 #ifdef WITH_NV_AFTERMATH
 #include "shader_database.hpp"
 #endif // #ifdef WITH_NV_AFTERMATH
 
 #include "../context.hpp"
+#include "../../utils/hash.hpp"
+#include "../../utils/thread_pool.hpp"
+
+#ifdef WITH_RUNTIME_SHADER_COMPILER
+#include <shaderc/shaderc.hpp>
+
 #include "file_includer.hpp"
+#include "shader_cache.hpp"
 
 static std::map<dp::ShaderStage, shaderc_shader_kind> shader_kinds {
     { dp::ShaderStage::RayGeneration, shaderc_raygen_shader },
@@ -19,12 +30,60 @@ static std::map<dp::ShaderStage, shaderc_shader_kind> shader_kinds {
     { dp::ShaderStage::Intersection, shaderc_intersection_shader },
     { dp::ShaderStage::Callable, shaderc_callable_shader },
 };
+#else
+#include "embedded_shaders.hpp"
+#endif // #ifdef WITH_RUNTIME_SHADER_COMPILER
+
+dp::SpecializationConstants& dp::SpecializationConstants::set(uint32_t constantId, uint32_t value) {
+    auto entry = std::find_if(entries.begin(), entries.end(), [constantId](const VkSpecializationMapEntry& entry) {
+        return entry.constantID == constantId;
+    });
+    if (entry != entries.end()) {
+        data[entry->offset / sizeof(uint32_t)] = value;
+        return *this;
+    }
+
+    entries.push_back({
+        .constantID = constantId,
+        .offset = static_cast<uint32_t>(data.size() * sizeof(uint32_t)),
+        .size = sizeof(uint32_t),
+    });
+    data.push_back(value);
+    return *this;
+}
+
+dp::SpecializationConstants& dp::SpecializationConstants::set(dp::SpecializationId constantId, uint32_t value) {
+    return set(static_cast<uint32_t>(constantId), value);
+}
+
+uint64_t dp::SpecializationConstants::getKey() const {
+    uint64_t key = dp::defaultHashSeed;
+    for (const auto& entry : entries) {
+        key = dp::hashValue(entry.constantID, key);
+        key = dp::hashValue(data[entry.offset / sizeof(uint32_t)], key);
+    }
+    return key;
+}
+
+const VkSpecializationInfo* dp::SpecializationConstants::getInfo() {
+    if (entries.empty())
+        return nullptr;
+    // The vectors may have been reallocated since the last call.
+    info = {
+        .mapEntryCount = static_cast<uint32_t>(entries.size()),
+        .pMapEntries = entries.data(),
+        .dataSize = data.size() * sizeof(uint32_t),
+        .pData = data.data(),
+    };
+    return &info;
+}
 
 dp::ShaderModule::ShaderModule(const dp::Context& context, std::string name, const dp::ShaderStage shaderStage)
         : ctx(context), name(std::move(name)), shaderStage(shaderStage) {
     
 }
 
+#ifdef WITH_RUNTIME_SHADER_COMPILER
 std::string dp::ShaderModule::readFile(const std::string& filename) {
     std::ifstream is(filename, std::ios::binary);
 
@@ -44,16 +103,43 @@ dp::ShaderCompileResult dp::ShaderModule::compileShader(const std::string& shade
     shaderc::Compiler compiler;
     shaderc::CompileOptions options;
 
-    // TODO: Macro definitions
-
-    std::unique_ptr<FileIncluder> includer(new FileIncluder());
-    options.SetIncluder(std::move(includer));
+    auto* includer = new FileIncluder();
+    options.SetIncluder(std::unique_ptr<FileIncluder>(includer));
     options.SetOptimizationLevel(shaderc_optimization_level_performance);
     options.SetTargetSpirv(shaderc_spirv_version_1_5);
     options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_2);
 
     shaderc_shader_kind kind = shader_kinds[shaderStage];
 
+    // Only Aftermath uses the binaries with debug info, to resolve shader addresses in crash dumps.
+#ifdef WITH_NV_AFTERMATH
+    constexpr bool needsDebugBinary = true;
+#else
+    constexpr bool needsDebugBinary = false;
+#endif
+#ifdef _DEBUG
+    constexpr bool generateDebugInfo = true;
+#else
+    constexpr bool generateDebugInfo = false;
+#endif
+
+    // Everything that is passed to the compiler besides the source has to be part of the key.
+    uint64_t optionsHash = dp::hashValue(kind);
+    optionsHash = dp::hashValue(shaderc_optimization_level_performance, optionsHash);
+    optionsHash = dp::hashValue(shaderc_spirv_version_1_5, optionsHash);
+    optionsHash = dp::hashValue(shaderc_env_version_vulkan_1_2, optionsHash);
+    optionsHash = dp::hashValue(generateDebugInfo, optionsHash);
+
+    // If neither the shader nor its includes changed, we don't even have to preprocess it.
+    ShaderCompileResult compileResult;
+    const uint64_t sourceHash = dp::hashString(shader_source, optionsHash);
+    std::vector<std::string> includedFiles;
+    uint64_t key = dp::ShaderCache::findKey(shaderName, optionsHash, sourceHash, includedFiles);
+    if (key != 0 && dp::ShaderCache::readBinaries(key, needsDebugBinary, compileResult)) {
+        compileResult.includedFiles = std::move(includedFiles);
+        return compileResult;
+    }
+
     auto checkResult = [=]<typename T>(shaderc::CompilationResult<T>& result) mutable {
         if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
             std::cerr << result.GetErrorMessage() << std::endl;
@@ -65,22 +151,41 @@ dp::ShaderCompileResult dp::ShaderModule::compileShader(const std::string& shade
     // Preprocess the files.
     auto result = compiler.PreprocessGlsl(shader_source, kind, shaderName.c_str(), options);
     const std::vector<char> preProcessedSourceChars = checkResult(result);
+    if (preProcessedSourceChars.empty())
+        return {};
     const std::string preProcessedSource = {preProcessedSourceChars.begin(), preProcessedSourceChars.end()};
 
-    // Compile to SPIR-V
-#ifdef _DEBUG
-    options.SetGenerateDebugInfo();
-#endif
-    auto compileResult = compiler.CompileGlslToSpv(preProcessedSource, kind, shaderName.c_str(), options);
-    auto binary = checkResult(compileResult);
+    // Preprocessing strips comments and resolves includes, so whitespace or comment changes
+    // still hit the cache here.
+    key = dp::hashString(preProcessedSource, optionsHash);
+    if (!dp::ShaderCache::readBinaries(key, needsDebugBinary, compileResult)) {
+        // Compile to SPIR-V
+        if (generateDebugInfo)
+            options.SetGenerateDebugInfo();
+        auto spirvResult = compiler.CompileGlslToSpv(preProcessedSource, kind, shaderName.c_str(), options);
+        compileResult.binary = checkResult(spirvResult);
+        if (compileResult.binary.empty())
+            return {};
 
-    options.SetGenerateDebugInfo();
-    auto debugCompileResult = compiler.CompileGlslToSpv(preProcessedSource, kind, shaderName.c_str(), options);
-    auto debugBinary = checkResult(debugCompileResult);
-    return { binary, debugBinary };
+        if (needsDebugBinary) {
+            options.SetGenerateDebugInfo();
+            auto debugCompileResult = compiler.CompileGlslToSpv(preProcessedSource, kind, shaderName.c_str(), options);
+            compileResult.debugBinary = checkResult(debugCompileResult);
+        }
+        dp::ShaderCache::writeBinaries(key, compileResult);
+    }
+    compileResult.includedFiles = includer->getIncludedFiles();
+    dp::ShaderCache::writeKey(shaderName, optionsHash, sourceHash, compileResult.includedFiles, key);
+    return compileResult;
 }
+#endif // #ifdef WITH_RUNTIME_SHADER_COMPILER
 
 void dp::ShaderModule::createShaderModule() {
+    // Pipelines don't reference their shader modules after creation, so a reloaded
+    // shader can destroy its previous module right away.
+    if (shaderModule != nullptr)
+        vkDestroyShaderModule(ctx.device, shaderModule, nullptr);
+
     VkShaderModuleCreateInfo moduleCreateInfo = {
         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
         .pNext = nullptr,
@@ -94,22 +199,79 @@ void dp::ShaderModule::createShaderModule() {
     ctx.setDebugUtilsName(shaderModule, name);
 #ifdef WITH_NV_AFTERMATH
     dp::ShaderDatabase::addShaderBinary(shaderCompileResult.binary);
-    dp::ShaderDatabase::addShaderWithDebugInfo(shaderCompileResult.debugBinary, shaderCompileResult.binary);
+    // Embedded shaders come without a debug binary.
+    if (!shaderCompileResult.debugBinary.empty())
+        dp::ShaderDatabase::addShaderWithDebugInfo(shaderCompileResult.debugBinary, shaderCompileResult.binary);
 #endif // #ifdef WITH_NV_AFTERMATH
 }
 
 void dp::ShaderModule::createShader(const std::string& filename) {
+#ifndef WITH_RUNTIME_SHADER_COMPILER
+    auto binary = dp::findEmbeddedShader(filename);
+    if (binary.empty())
+        throw std::runtime_error(std::string("No embedded SPIR-V for shader: ") + filename);
+    createShader(filename, binary);
+#else
+    auto start = std::chrono::steady_clock::now();
     auto fileContents = readFile(filename);
-    shaderCompileResult = compileShader(filename, fileContents);
+    auto compileResult = compileShader(filename, fileContents);
+    // Keep the previous module if this is a reload with errors.
+    if (compileResult.binary.empty())
+        throw std::runtime_error(std::string("Failed to compile shader: ") + filename);
+
+    filePath = filename;
+    shaderCompileResult = std::move(compileResult);
+    createShaderModule();
+    std::chrono::duration<double, std::milli> creationTime = std::chrono::steady_clock::now() - start;
+    fmt::print("Created shader {} in {:.2f}ms\n", name, creationTime.count());
+#endif // #ifndef WITH_RUNTIME_SHADER_COMPILER
+}
+
+void dp::ShaderModule::createShader(const std::string& filename, std::span<const uint32_t> binary) {
+    filePath = filename;
+    shaderCompileResult = { .binary = { binary.begin(), binary.end() } };
     createShaderModule();
 }
 
-VkPipelineShaderStageCreateInfo dp::ShaderModule::getShaderStageCreateInfo() const {
+void dp::ShaderModule::createShaderAsync(const std::string& filename, dp::ThreadPool& threadPool) {
+    // Every compile uses its own shaderc::Compiler and FileIncluder, so they can run in parallel.
+    creation = threadPool.submit([this, filename]() {
+        createShader(filename);
+    }).share();
+}
+
+void dp::ShaderModule::wait() {
+    if (!creation.valid())
+        return;
+    // A failed creation leaves the previous module untouched, so it is only reported once.
+    auto finishedCreation = std::move(creation);
+    finishedCreation.get();
+}
+
+bool dp::ShaderModule::isReady() const {
+    return !creation.valid() || creation.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+bool dp::ShaderModule::dependsOn(const fs::path& file) const {
+    auto normalFile = file.lexically_normal();
+    if (fs::path(filePath).lexically_normal() == normalFile)
+        return true;
+    return std::any_of(shaderCompileResult.includedFiles.begin(), shaderCompileResult.includedFiles.end(), [&](const std::string& include) {
+        return fs::path(include).lexically_normal() == normalFile;
+    });
+}
+
+auto dp::ShaderModule::getFilePath() const -> const std::string& {
+    return filePath;
+}
+
+VkPipelineShaderStageCreateInfo dp::ShaderModule::getShaderStageCreateInfo(const VkSpecializationInfo* specializationInfo) const {
     return {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
         .stage = static_cast<VkShaderStageFlagBits>(this->shaderStage),
         .module = this->shaderModule,
         .pName = "main",
+        .pSpecializationInfo = specializationInfo,
     };
 }
 
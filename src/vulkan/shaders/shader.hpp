@@ -1,9 +1,13 @@
 #pragma once
 
+#include <filesystem>
+#include <future>
 #include <map>
+#include <span>
 
 #include <vulkan/vulkan.h>
-#include <shaderc/shaderc.hpp>
+
+namespace fs = std::filesystem;
 
 namespace dp {
     enum class ShaderStage : uint64_t {
@@ -25,30 +29,84 @@ namespace dp {
 
     // fwd.
     class Context;
+    class ThreadPool;
 
     struct ShaderCompileResult {
         std::vector<uint32_t> binary;
         std::vector<uint32_t> debugBinary;
+        /** All files the shader includes, directly or through other includes. */
+        std::vector<std::string> includedFiles;
+    };
+
+    /** The IDs of the specialization constants of our shaders, declared in shaders/include/raycommon.glsl. */
+    enum class SpecializationId : uint32_t {
+        SampleCount = 0,
+        MaxBounceDepth = 1,
+    };
+
+    /**
+     * The values of specialization constants, which choose a variant of a shader when creating
+     * a pipeline without having to recompile it. All constants have to be 32-bit.
+     */
+    class SpecializationConstants {
+        std::vector<VkSpecializationMapEntry> entries;
+        std::vector<uint32_t> data;
+        VkSpecializationInfo info = {};
+
+    public:
+        SpecializationConstants& set(uint32_t constantId, uint32_t value);
+        SpecializationConstants& set(dp::SpecializationId constantId, uint32_t value);
+
+        /** Identifies this set of values, to cache the pipelines using them. */
+        [[nodiscard]] auto getKey() const -> uint64_t;
+        /** Gets the info to pass to shader stages, or nullptr if there are no constants. */
+        [[nodiscard]] auto getInfo() -> const VkSpecializationInfo*;
     };
 
     class ShaderModule {
         const dp::Context& ctx;
         std::string name;
+        std::string filePath;
 
         VkShaderModule shaderModule = nullptr;
         dp::ShaderStage shaderStage;
 
         ShaderCompileResult shaderCompileResult;
+        /** Completes once the shader started with createShaderAsync has been created. */
+        std::shared_future<void> creation;
 
         void createShaderModule();
+#ifdef WITH_RUNTIME_SHADER_COMPILER
         [[nodiscard]] auto compileShader(const std::string& shaderName, const std::string& shader_source) const -> ShaderCompileResult;
         [[nodiscard]] static auto readFile(const std::string& filepath) -> std::string;
+#endif
 
     public:
         explicit ShaderModule(const dp::Context& context, std::string  name, dp::ShaderStage shaderStage);
 
+        /**
+         * Creates the shader from given source file. Without the runtime compiler, this uses the
+         * SPIR-V that has been compiled from the file and embedded at build time instead.
+         */
         void createShader(const std::string& filename);
-        [[nodiscard]] auto getShaderStageCreateInfo() const -> VkPipelineShaderStageCreateInfo;
+        /** Creates the shader from precompiled SPIR-V. */
+        void createShader(const std::string& filename, std::span<const uint32_t> binary);
+        /**
+         * Compiles and creates the shader on given thread pool, so that multiple shaders can
+         * compile at the same time. wait() has to be called before the module is used.
+         */
+        void createShaderAsync(const std::string& filename, dp::ThreadPool& threadPool);
+        /**
+         * Waits for the creation started by createShaderAsync, rethrowing any of its exceptions. An exception
+         * is only rethrown once, after which the module created before the failed one stays in use.
+         */
+        void wait();
+        /** Whether the creation started by createShaderAsync has finished, successfully or not. */
+        [[nodiscard]] bool isReady() const;
+        /** Whether given file is the source of this shader, or one of the files it includes. */
+        [[nodiscard]] bool dependsOn(const fs::path& file) const;
+        [[nodiscard]] auto getFilePath() const -> const std::string&;
+        [[nodiscard]] auto getShaderStageCreateInfo(const VkSpecializationInfo* specializationInfo = nullptr) const -> VkPipelineShaderStageCreateInfo;
         [[nodiscard]] auto getShaderStage() const -> dp::ShaderStage;
         [[nodiscard]] auto getHandle() const -> VkShaderModule;
     };
@@ -0,0 +1,120 @@
+#include "shader_cache.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <utility>
+
+#include <fmt/core.h>
+
+#include "shader.hpp"
+#include "../../utils/binary_file.hpp"
+#include "../../utils/hash.hpp"
+#include "../../utils/mapped_file.hpp"
+
+auto dp::ShaderCache::getManifestPath(const std::string& shaderName, uint64_t optionsHash) -> fs::path {
+    return cacheDirectory / fmt::format("{:016x}.dpsm", dp::hashString(shaderName, optionsHash));
+}
+
+auto dp::ShaderCache::getBinaryPath(uint64_t key) -> fs::path {
+    return cacheDirectory / fmt::format("{:016x}.spv", key);
+}
+
+auto dp::ShaderCache::hashFile(const fs::path& path) -> uint64_t {
+    // Includes are read as text by the FileIncluder, but hashing the raw bytes is just as good.
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream.is_open())
+        return 0;
+    std::string contents((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    return dp::hashString(contents);
+}
+
+bool dp::ShaderCache::openFile(const fs::path& path, dp::BinaryFileWriter& writer) {
+    std::error_code error;
+    fs::create_directories(cacheDirectory, error);
+    if (!writer.open(path)) {
+        fmt::print(stderr, "Failed to create shader cache file {}\n", path.string());
+        return false;
+    }
+    return true;
+}
+
+auto dp::ShaderCache::findKey(const std::string& shaderName, uint64_t optionsHash, uint64_t sourceHash,
+                              std::vector<std::string>& includedFiles) -> uint64_t {
+    dp::MappedFile manifest;
+    if (!manifest.open(getManifestPath(shaderName, optionsHash)))
+        return 0;
+
+    dp::BinaryReader reader(manifest.getData(), manifest.getSize());
+    ManifestHeader header = {};
+    const ManifestHeader expected = {};
+    if (!reader.read(header) || header.magic != expected.magic || header.version != expected.version
+        || header.sourceHash != sourceHash)
+        return 0;
+
+    std::vector<std::string> dependencies;
+    for (uint64_t i = 0; i < header.dependencyCount; ++i) {
+        std::string path;
+        uint64_t hash = 0;
+        if (!reader.readString(path) || !reader.read(hash) || hashFile(path) != hash)
+            return 0;
+        dependencies.push_back(std::move(path));
+    }
+    includedFiles = std::move(dependencies);
+    return header.key;
+}
+
+void dp::ShaderCache::writeKey(const std::string& shaderName, uint64_t optionsHash, uint64_t sourceHash,
+                               const std::vector<std::string>& includedFiles, uint64_t key) {
+    auto manifestPath = getManifestPath(shaderName, optionsHash);
+    dp::BinaryFileWriter writer;
+    if (!openFile(manifestPath, writer))
+        return;
+    writer.write(ManifestHeader {
+        .sourceHash = sourceHash,
+        .key = key,
+        .dependencyCount = includedFiles.size(),
+    });
+    for (const auto& path : includedFiles) {
+        writer.writeString(path);
+        writer.write(hashFile(path));
+    }
+    if (!writer.commit())
+        fmt::print(stderr, "Failed to write shader cache file {}\n", manifestPath.string());
+}
+
+bool dp::ShaderCache::readBinaries(uint64_t key, bool needsDebugBinary, dp::ShaderCompileResult& result) {
+    dp::MappedFile file;
+    if (!file.open(getBinaryPath(key)))
+        return false;
+
+    dp::BinaryReader reader(file.getData(), file.getSize());
+    BinaryHeader header = {};
+    const BinaryHeader expected = {};
+    if (!reader.read(header) || header.magic != expected.magic || header.version != expected.version
+        || header.binarySize == 0 || (needsDebugBinary && header.debugBinarySize == 0))
+        return false;
+
+    ShaderCompileResult binaries;
+    if (!reader.readArray(binaries.binary, header.binarySize)
+        || !reader.readArray(binaries.debugBinary, header.debugBinarySize)) {
+        fmt::print(stderr, "Shader cache file {} is corrupted.\n", getBinaryPath(key).string());
+        return false;
+    }
+    result = std::move(binaries);
+    return true;
+}
+
+void dp::ShaderCache::writeBinaries(uint64_t key, const dp::ShaderCompileResult& result) {
+    auto binaryPath = getBinaryPath(key);
+    dp::BinaryFileWriter writer;
+    if (!openFile(binaryPath, writer))
+        return;
+    writer.write(BinaryHeader {
+        .binarySize = result.binary.size(),
+        .debugBinarySize = result.debugBinary.size(),
+    });
+    writer.write(result.binary.data(), result.binary.size() * sizeof(uint32_t));
+    writer.write(result.debugBinary.data(), result.debugBinary.size() * sizeof(uint32_t));
+    if (!writer.commit())
+        fmt::print(stderr, "Failed to write shader cache file {}\n", binaryPath.string());
+}
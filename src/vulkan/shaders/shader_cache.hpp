@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace dp {
+    class BinaryFileWriter;
+    struct ShaderCompileResult;
+
+    /**
+     * An on-disk cache of compiled SPIR-V, keyed by the hash of the preprocessed source together
+     * with the compile options and stage. A manifest per shader remembers the files it included
+     * and the key they preprocessed to, so that unchanged shaders never need shaderc at all.
+     */
+    class ShaderCache {
+        static constexpr uint32_t fileMagic = 0x48535044; // "DPSH"
+        /** Has to be incremented whenever the file layout changes. */
+        static constexpr uint32_t formatVersion = 1;
+
+        struct ManifestHeader {
+            uint32_t magic = fileMagic;
+            uint32_t version = formatVersion;
+            uint64_t sourceHash = 0;
+            uint64_t key = 0;
+            uint64_t dependencyCount = 0;
+        };
+
+        struct BinaryHeader {
+            uint32_t magic = fileMagic;
+            uint32_t version = formatVersion;
+            uint64_t binarySize = 0;
+            uint64_t debugBinarySize = 0;
+        };
+
+        [[nodiscard]] static auto getManifestPath(const std::string& shaderName, uint64_t optionsHash) -> fs::path;
+        [[nodiscard]] static auto getBinaryPath(uint64_t key) -> fs::path;
+        /** Hashes the file at given path, or returns 0 if it cannot be read. */
+        [[nodiscard]] static auto hashFile(const fs::path& path) -> uint64_t;
+        /** Opens given file of the cache directory for writing, creating the directory if needed. */
+        static bool openFile(const fs::path& path, dp::BinaryFileWriter& writer);
+
+    public:
+        static inline const fs::path cacheDirectory = "shader_cache";
+
+        /**
+         * Gets the key the shader preprocessed to last time, and the files it included, if neither its
+         * source nor any of its includes have changed since. Returns 0 otherwise.
+         */
+        [[nodiscard]] static auto findKey(const std::string& shaderName, uint64_t optionsHash, uint64_t sourceHash,
+                                          std::vector<std::string>& includedFiles) -> uint64_t;
+        /** Remembers the key of the preprocessed shader, and the files it included. */
+        static void writeKey(const std::string& shaderName, uint64_t optionsHash, uint64_t sourceHash,
+                             const std::vector<std::string>& includedFiles, uint64_t key);
+
+        /** Reads the binaries for given key. Returns false if there are none, or the debug binary is needed but missing. */
+        [[nodiscard]] static bool readBinaries(uint64_t key, bool needsDebugBinary, dp::ShaderCompileResult& result);
+        static void writeBinaries(uint64_t key, const dp::ShaderCompileResult& result);
+    };
+}
@@ -1,6 +1,7 @@
 #ifdef WITH_NV_AFTERMATH
 
 #include <map>
+#include <mutex>
 #include "shader_database.hpp"
 #include "../base/crash_tracker.hpp"
 
@@ -24,6 +25,8 @@ inline bool operator<(GFSDK_Aftermath_ShaderDebugInfoIdentifier a, GFSDK_Afterma
 std::map<GFSDK_Aftermath_ShaderHash, std::vector<uint32_t>> shaderBinaries = {};
 std::map<GFSDK_Aftermath_ShaderDebugName, std::vector<uint32_t>> shaderBinariesWithDebugInfo;
 std::map<GFSDK_Aftermath_ShaderDebugInfoIdentifier, std::vector<uint8_t>> shaderDebugInfos = {};
+// Shaders are added from the compile threads, and looked up from the crash dump callbacks.
+std::mutex databaseMutex;
 
 void dp::ShaderDatabase::addShaderBinary(std::vector<uint32_t>& binary) {
     const GFSDK_Aftermath_SpirvCode shader { binary.data(), static_cast<uint32_t>(binary.size()), };
@@ -34,11 +37,13 @@ void dp::ShaderDatabase::addShaderBinary(std::vector<uint32_t>& binary) {
         &shaderHash
     ));
 
+    std::lock_guard guard(databaseMutex);
     shaderBinaries[shaderHash].assign(binary.begin(), binary.end());
 }
 
 void dp::ShaderDatabase::addShaderDebugInfos(const GFSDK_Aftermath_ShaderDebugInfoIdentifier& identifier,
                                              std::vector<uint8_t>& debugInfos) {
+    std::lock_guard guard(databaseMutex);
     shaderDebugInfos[identifier].swap(debugInfos);
 }
 
@@ -53,10 +58,12 @@ void dp::ShaderDatabase::addShaderWithDebugInfo(std::vector<uint32_t>& strippedB
         &debugName
     ));
 
+    std::lock_guard guard(databaseMutex);
     shaderBinariesWithDebugInfo[debugName].assign(binary.begin(),  binary.end());
 }
 
 bool dp::ShaderDatabase::findShaderBinary(const GFSDK_Aftermath_ShaderHash* shaderHash, std::vector<uint32_t>& binary) {
+    std::lock_guard guard(databaseMutex);
     auto shader = shaderBinaries.find(*shaderHash);
     if (shader == shaderBinaries.end())
         return false;
@@ -66,6 +73,7 @@ bool dp::ShaderDatabase::findShaderBinary(const GFSDK_Aftermath_ShaderHash* shad
 
 bool dp::ShaderDatabase::findShaderDebugInfos(const GFSDK_Aftermath_ShaderDebugInfoIdentifier* identifier,
                                               std::vector<uint8_t>& debugInfos) {
+    std::lock_guard guard(databaseMutex);
     auto dbg = shaderDebugInfos.find(*identifier);
     if (dbg == shaderDebugInfos.end())
         return false;
@@ -75,6 +83,7 @@ bool dp::ShaderDatabase::findShaderDebugInfos(const GFSDK_Aftermath_ShaderDebugI
 
 bool dp::ShaderDatabase::findShaderBinaryWithDebugInfo(const GFSDK_Aftermath_ShaderDebugName* shaderDebugName,
                                                        std::vector<uint32_t>& binary) {
+    std::lock_guard guard(databaseMutex);
     auto shader = shaderBinariesWithDebugInfo.find(*shaderDebugName);
     if (shader == shaderBinariesWithDebugInfo.end())
         return false;